@@ -13,137 +13,76 @@ extern "C" {
     #include <libavutil/channel_layout.h>
     #include <libavutil/samplefmt.h>
 }
-//equaliser to  enhance clarity, bass, or treble as desired. 
-void apply_equalizer(AVFrame* frame, enum AVSampleFormat format, float bass_gain, float treble_gain) {
-   
-    for (int i = 0; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* sample = (float*)frame->data[ch] + i;
-                    if (*sample < 100.0f && *sample>=50.0f) {  // Apply bass gain for low frequencies
-                        *sample *= bass_gain;
-                    } 
-                    else if (*sample > 5000.0f) {  // Apply treble gain for high frequencies
-                        *sample *= treble_gain;
-                    }
-                    *sample = std::clamp(*sample, -1.0f, 1.0f);
-                    break;
-                }
-                default:
-                    break;
-            }
-        }
+#include "PacketPool.h"
+#include "SampleFormat.h"
+#include "EffectChain.h"
+#include "Biquad.h"
+#include "Convolver.h"
+#include "SlidingWindow.h"
+
+// Noise reduction settings, used for every frame and for the samples the
+// smoother still holds at the end of the stream
+const float kNoiseThreshold = 0.01f;  // Adjust noise threshold
+const int kNoiseWindow = 10; //smoothening factor
+
+// Filter state that carries from one frame of the stream to the next
+struct StreamEffects {
+    BiquadBank bandpass;
+    BiquadBank equalizer;
+    Convolver reverb;
+    SlidingWindow smoother;
+};
+//equaliser to  enhance clarity, bass, or treble as desired: shelves below
+//100 Hz and above 5 kHz, gains linear
+void apply_equalizer(BiquadBank& equalizer, AVFrame* frame, enum AVSampleFormat format, float bass_gain, float treble_gain) {
+    int channels = frame->ch_layout.nb_channels;
+    if (frame->sample_rate <= 0) {
+        return;
     }
+    if (!equalizer.configured_for(frame->sample_rate, channels)) {
+        equalizer.configure(design_equalizer(frame->sample_rate, 100.0, bass_gain, 5000.0, treble_gain), channels, frame->sample_rate);
+    }
+    visit_samples(frame, format, [&](auto samples) {
+        equalizer.process(samples, frame->nb_samples);
+    });
 }
 //Compression reduces the volume of louder sounds and increases the volume of quieter sounds, which can help maintain consistency and make softer sounds more audible.
 void apply_compression(AVFrame* frame, enum AVSampleFormat format, float threshold, float ratio) {
-   
-    for (int i = 0; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* sample = (float*)frame->data[ch] + i;
-                    if (std::abs(*sample) > threshold) {
-                        *sample = threshold + (*sample - threshold) / ratio;
-                    }
-                    *sample = std::clamp(*sample, -1.0f, 1.0f);
-                    break;
-                }
-                default:
-                    break;
-            }
-        }
-    }
+    run_effect_chain(frame, format, Compressor{threshold, ratio});
 }
-//Adding a subtle reverb can enhance the audio's natural quality
-void apply_reverb(AVFrame* frame, enum AVSampleFormat format, float decay_factor, int delay_samples) {
-    
-    for (int i = delay_samples; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* current_sample = (float*)frame->data[ch] + i;
-                    float* delayed_sample = (float*)frame->data[ch] + i - delay_samples;
-                    *current_sample += (*delayed_sample) * decay_factor;
-                    *current_sample = std::clamp(*current_sample, -1.0f, 1.0f);
-                    break;
-                }
-                default:
-                    break;
-            }
-        }
+//Adding a subtle reverb can enhance the audio's natural quality: the frame
+//convolved with a synthetic room of room_seconds, mixed in at wet_level
+void apply_reverb(Convolver& reverb, AVFrame* frame, enum AVSampleFormat format, float wet_level, float room_seconds, float room_rt60) {
+    int channels = frame->ch_layout.nb_channels;
+    if (frame->sample_rate <= 0) {
+        return;
+    }
+    if (!reverb.configured_for(frame->sample_rate, channels)) {
+        reverb.configure(synthetic_room_impulse(frame->sample_rate, room_seconds, room_rt60), channels, 512, frame->sample_rate);
     }
+    visit_samples(frame, format, [&](auto samples) {
+        reverb.process(samples, frame->nb_samples, 1.0f, wet_level);
+    });
 }
 
-void apply_bandpass_filter(AVFrame* frame, enum AVSampleFormat format, float low_cutoff, float high_cutoff) {
-    
-    for (int i = 0; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* sample = (float*)frame->data[ch] + i;
-
-                    // Frequencies below low_cutoff are reduced (bass cut)
-                    if (*sample < low_cutoff) {
-                        *sample *= 0.1f; // Reduce bass frequencies drastically
-                    }
-                    
-                    // Frequencies above high_cutoff are reduced (treble cut)
-                    else if (*sample > high_cutoff) {
-                        *sample *= 0.1f; // Reduce high frequencies drastically
-                    }
-                    else{
-                    	*sample *=3.0f; // Reduce high frequencies drastically
-                    }
-                    // Clamp values to avoid distortion
-                    *sample = std::clamp(*sample, -1.0f, 1.0f);
-                    break;
-                }
-                default:
-                    break;
-            }
-        }
+// Band-limits to low_cutoff..high_cutoff Hz (4th-order Butterworth on each
+// side), scaled by passband_gain
+void apply_bandpass_filter(BiquadBank& bandpass, AVFrame* frame, enum AVSampleFormat format, float low_cutoff, float high_cutoff, float passband_gain) {
+    int channels = frame->ch_layout.nb_channels;
+    if (frame->sample_rate <= 0) {
+        return;
     }
+    if (!bandpass.configured_for(frame->sample_rate, channels)) {
+        bandpass.configure(design_bandpass(frame->sample_rate, low_cutoff, high_cutoff, passband_gain), channels, frame->sample_rate);
+    }
+    visit_samples(frame, format, [&](auto samples) {
+        bandpass.process(samples, frame->nb_samples);
+    });
 }
 
 //adjust volume
 void adjust_volume(AVFrame* frame, enum AVSampleFormat format, float gain){
-    
-    for (int i = 0; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            // Adjust volume
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* sample = (float*)frame->data[ch] + i;
-                    *sample *= gain;
-                    *sample = std::clamp(*sample, -1.0f, 1.0f);
-                    break;
-                }
-                case AV_SAMPLE_FMT_S16:
-                case AV_SAMPLE_FMT_S16P: {
-                    int16_t* sample = (int16_t*)frame->data[ch] + i;
-                    int32_t temp = *sample * gain;
-                    *sample = std::clamp(temp, (int32_t)INT16_MIN, (int32_t)INT16_MAX);
-                    break;
-                }
-                case AV_SAMPLE_FMT_S32:
-                case AV_SAMPLE_FMT_S32P: {
-                    int32_t* sample = (int32_t*)frame->data[ch] + i;
-                    int64_t temp = *sample * gain;
-                    *sample = std::clamp(temp, (int64_t)INT32_MIN, (int64_t)INT32_MAX);
-                    break;
-                }
-                default:
-                    break;
-            }
-        }
-    }
+    run_effect_chain(frame, format, Gain{gain});
 }
 
 /*void noise_reduction(AVFrame* frame, enum AVSampleFormat format, float noise_threshold, int window_size) {
@@ -227,88 +166,41 @@ void adjust_volume(AVFrame* frame, enum AVSampleFormat format, float gain){
     }
 }*/
 
-void noise_reduction(AVFrame* frame, enum AVSampleFormat format, float noise_threshold, int window_size) {
+// Adaptive noise thresholding of the smoothed signal
+float noise_gate(float smoothed_sample, float noise_threshold) {
+    float adaptive_threshold = noise_threshold * (1.0f + 0.1f * (1.0f - fabs(smoothed_sample)));
+    return (fabs(smoothed_sample) < adaptive_threshold) ? 0.0f : fmaxf(-0.7f, fminf(smoothed_sample, 0.7f));
+}
+
+// Exponentially weighted moving average (weight e^(-|j| / half_window) at
+// distance j), then an adaptive gate. Runs in O(n) with the window carried
+// across frames; output trails input by window_size / 2 samples.
+void noise_reduction(SlidingWindow& smoother, AVFrame* frame, enum AVSampleFormat format, float noise_threshold, int window_size) {
     if (window_size % 2 == 0) {
         window_size++;
     }
 
     int half_window = window_size / 2;
+    int channels = frame->ch_layout.nb_channels;
+    if (!smoother.configured_for(SlidingWindow::Kernel::exponential, half_window, channels)) {
+        smoother.configure(SlidingWindow::Kernel::exponential, half_window, channels);
+    }
 
-    for (int i = 0; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            float smoothed_sample = 0.0f;
-            float weight_sum = 0.0f;
-            int count = 0;
-
-            for (int j = -half_window; j <= half_window; j++) {
-                int index = i + j;
-                if (index >= 0 && index < frame->nb_samples) {
-                    float current_sample = 0.0f;
-                    switch (format) {
-                        case AV_SAMPLE_FMT_FLT:
-                        case AV_SAMPLE_FMT_FLTP: {
-                            float* sample = (float*)frame->data[ch] + index;
-                            current_sample = *sample ;
-                            break;
-                        }
-                        case AV_SAMPLE_FMT_S16:
-                        case AV_SAMPLE_FMT_S16P: {
-                            int16_t* sample = (int16_t*)frame->data[ch] + index;
-                            current_sample = (float)(*sample) / INT16_MAX;
-                            break;
-                        }
-                        case AV_SAMPLE_FMT_S32:
-                        case AV_SAMPLE_FMT_S32P: {
-                            int32_t* sample = (int32_t*)frame->data[ch] + index;
-                            current_sample = (float)(*sample) / INT32_MAX;
-                            break;
-                        }
-                        default:
-                            break;
-                    }
-
-                    // Gaussian weight based on distance from the current sample
-                    float weight = expf(-fabs((float)j) / half_window);
-                    smoothed_sample += current_sample * weight*0.7;
-                    weight_sum += (weight*0.7);
-                    count++;
-                }
-            }
-
-            if (count > 0) {
-                smoothed_sample /= weight_sum;
-            }
-
-            // Adaptive noise thresholding
-            float adaptive_threshold = noise_threshold * (1.0f + 0.1f * (1.0f - fabs(smoothed_sample)));
+    visit_samples(frame, format, [&](auto samples) {
+        smoother.process(samples, frame->nb_samples, [&](float smoothed_sample) {
+            return noise_gate(smoothed_sample, noise_threshold);
+        });
+    });
+}
 
-          
-            
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* sample = (float*)frame->data[ch] + i;
-                    *sample = (fabs(smoothed_sample) < adaptive_threshold) ? 0.0f : fmaxf(-0.7f, fminf(smoothed_sample, 0.7f));
-                    break;
-                }
-                case AV_SAMPLE_FMT_S16:
-                case AV_SAMPLE_FMT_S16P: {
-                    int16_t* sample = (int16_t*)frame->data[ch] + i;
-                    *sample = (fabs(smoothed_sample) < adaptive_threshold) ? 0 : (int16_t)fmaxf(INT16_MIN*0.7f, fminf(smoothed_sample * (INT16_MAX)*0.7f, INT16_MAX*0.7f));
-                    break;
-                }
-                case AV_SAMPLE_FMT_S32:
-                case AV_SAMPLE_FMT_S32P: {
-                    int32_t* sample = (int32_t*)frame->data[ch] + i;
-                    *sample = (fabs(smoothed_sample) < adaptive_threshold) ? 0 : (int32_t)fmaxf(INT32_MIN*0.7f, fminf(smoothed_sample * (INT32_MAX*0.7f), INT32_MAX*0.7f));
-                    break;
-                }
-                default:
-                    break;
-            }
-            
-        }
-    }
+// End of stream: writes the last samples the smoother holds back, gated
+// like the rest, into frame, which holds smoother.latency() samples
+void flush_noise_reduction(SlidingWindow& smoother, AVFrame* frame, enum AVSampleFormat format, float noise_threshold) {
+    visit_samples(frame, format, [&](auto samples) {
+        smoother.flush(samples, [&](float smoothed_sample) {
+            return noise_gate(smoothed_sample, noise_threshold);
+        });
+    });
 }
 
 void mute_silent_sections(AVFrame* frame, enum AVSampleFormat format, float silence_threshold, int window_size) {
@@ -318,84 +210,43 @@ void mute_silent_sections(AVFrame* frame, enum AVSampleFormat format, float sile
 
     int half_window = window_size / 2;
 
-    for (int i = 0; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            float smoothed_sample = 0.0f;
-            float weight_sum = 0.0f;
-            int silent_count = 0;
-
-            for (int j = -half_window; j <= half_window; j++) {
-                int index = i + j;
-                if (index >= 0 && index < frame->nb_samples) {
-                    float current_sample = 0.0f;
-                    switch (format) {
-                        case AV_SAMPLE_FMT_FLT:
-                        case AV_SAMPLE_FMT_FLTP: {
-                            float* sample = (float*)frame->data[ch] + index;
-                            current_sample = *sample;
-                            break;
-                        }
-                        case AV_SAMPLE_FMT_S16:
-                        case AV_SAMPLE_FMT_S16P: {
-                            int16_t* sample = (int16_t*)frame->data[ch] + index;
-                            current_sample = (float)(*sample) / INT16_MAX;
-                            break;
-                        }
-                        case AV_SAMPLE_FMT_S32:
-                        case AV_SAMPLE_FMT_S32P: {
-                            int32_t* sample = (int32_t*)frame->data[ch] + index;
-                            current_sample = (float)(*sample) / INT32_MAX;
-                            break;
+    visit_samples(frame, format, [&](auto samples) {
+        for (int ch = 0; ch < samples.channels; ch++) {
+            for (int i = 0; i < frame->nb_samples; i++) {
+                float smoothed_sample = 0.0f;
+                float weight_sum = 0.0f;
+                int silent_count = 0;
+
+                for (int j = -half_window; j <= half_window; j++) {
+                    int index = i + j;
+                    if (index >= 0 && index < frame->nb_samples) {
+                        float current_sample = samples.load(ch, index);
+
+                        float weight = 1.0f - (fabs((float)j) / half_window);
+                        smoothed_sample += current_sample * weight;
+                        weight_sum += weight;
+
+                        // Count silent samples (below the silence threshold)
+                        if (fabs(current_sample) < silence_threshold) {
+                            silent_count++;
                         }
-                        default:
-                            break;
-                    }
-
-                    float weight = 1.0f - (fabs((float)j) / half_window);
-                    smoothed_sample += current_sample * weight;
-                    weight_sum += weight;
-
-                    // Count silent samples (below the silence threshold)
-                    if (fabs(current_sample) < silence_threshold) {
-                        silent_count++;
                     }
                 }
-            }
 
-            if (weight_sum > 0) {
-                smoothed_sample /= weight_sum;
-            }
-
-            // Check if majority of the samples in the window are silent
-            if (silent_count > half_window) {
-                // Mute this sample if most samples in the window are silent
-                smoothed_sample = 0.0f;
-            }
-
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* sample = (float*)frame->data[ch] + i;
-                    *sample = (fabs(smoothed_sample) < silence_threshold) ? 0.0f : fmaxf(-0.8f, fminf(smoothed_sample, 0.8f));
-                    break;
+                if (weight_sum > 0) {
+                    smoothed_sample /= weight_sum;
                 }
-                case AV_SAMPLE_FMT_S16:
-                case AV_SAMPLE_FMT_S16P: {
-                    int16_t* sample = (int16_t*)frame->data[ch] + i;
-                    *sample = (fabs(smoothed_sample) < silence_threshold) ? 0 : (int16_t)fmaxf(INT16_MIN+2048, fminf(smoothed_sample * INT16_MAX, INT16_MAX-2048));
-                    break;
-                }
-                case AV_SAMPLE_FMT_S32:
-                case AV_SAMPLE_FMT_S32P: {
-                    int32_t* sample = (int32_t*)frame->data[ch] + i;
-                    *sample = (fabs(smoothed_sample) < silence_threshold) ? 0 : (int32_t)fmaxf(INT32_MIN+32256, fminf(smoothed_sample * INT32_MAX, INT32_MAX-32256));
-                    break;
+
+                // Check if majority of the samples in the window are silent
+                if (silent_count > half_window) {
+                    // Mute this sample if most samples in the window are silent
+                    smoothed_sample = 0.0f;
                 }
-                default:
-                    break;
+
+                samples.store(ch, i, (fabs(smoothed_sample) < silence_threshold) ? 0.0f : fmaxf(-0.8f, fminf(smoothed_sample, 0.8f)));
             }
         }
-    }
+    });
 }
 
 
@@ -467,84 +318,27 @@ void normalize_audio(AVFrame* frame, enum AVSampleFormat format, float target_le
 }*/
 
 void normalize_audio_with_noise_gate(AVFrame* frame, enum AVSampleFormat format, float target_level, float noise_gate_threshold) {
-    float max_sample_value = 0.0f;
-
-    // First pass: find the maximum sample value and apply noise gate
-    for (int i = 0; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* sample = (float*)frame->data[ch] + i;
-                    // Apply noise gate
-                    if (fabs(*sample) < noise_gate_threshold) {
-                        *sample = 0.0f;  // Mute if below threshold
-                    } else {
-                        max_sample_value = std::max(max_sample_value, std::fabs(*sample));
-                    }
-                    break;
-                }
-                case AV_SAMPLE_FMT_S16:
-                case AV_SAMPLE_FMT_S16P: {
-                    int16_t* sample = (int16_t*)frame->data[ch] + i;
-                    // Apply noise gate
-                    if (fabs(static_cast<float>(*sample)) < noise_gate_threshold) {
-                        *sample = 0;  // Mute if below threshold
-                    } else {
-                        max_sample_value = std::max(max_sample_value, std::fabs(static_cast<float>(*sample)));
-                    }
-                    break;
-                }
-                case AV_SAMPLE_FMT_S32:
-                case AV_SAMPLE_FMT_S32P: {
-                    int32_t* sample = (int32_t*)frame->data[ch] + i;
-                    // Apply noise gate
-                    if (fabs(static_cast<float>(*sample)) < noise_gate_threshold) {
-                        *sample = 0;  // Mute if below threshold
-                    } else {
-                        max_sample_value = std::max(max_sample_value, std::fabs(static_cast<float>(*sample)));
-                    }
-                    break;
-                }
-                default:
-                    break;
-            }
-        }
-    }
-
-    // Calculate the normalization factor
-    float normalization_factor = (max_sample_value > 0) ? target_level / max_sample_value : 1.0f;
-
-    // Second pass: normalize samples
-    for (int i = 0; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* sample = (float*)frame->data[ch] + i;
-                    *sample *= normalization_factor; // Scale sample
-                    *sample = std::clamp(*sample, -1.0f, 1.0f); // Clamp to float range
-                    break;
-                }
-                case AV_SAMPLE_FMT_S16:
-                case AV_SAMPLE_FMT_S16P: {
-                    int16_t* sample = (int16_t*)frame->data[ch] + i;
-                    float scaled_sample = static_cast<float>(*sample) * normalization_factor;
-                    *sample = std::clamp(static_cast<int16_t>(scaled_sample), static_cast<int16_t>(INT16_MIN), static_cast<int16_t>(INT16_MAX));
-                    break;
-                }
-                case AV_SAMPLE_FMT_S32:
-                case AV_SAMPLE_FMT_S32P: {
-                    int32_t* sample = (int32_t*)frame->data[ch] + i;
-                    float scaled_sample = static_cast<float>(*sample) * normalization_factor;
-                    *sample = std::clamp(static_cast<int32_t>(scaled_sample), static_cast<int32_t>(INT32_MIN), static_cast<int32_t>(INT32_MAX));
-                    break;
-                }
-                default:
-                    break;
+    visit_samples(frame, format, [&](auto samples) {
+        float max_sample_value = 0.0f;
+
+        // First pass: find the maximum sample value and apply noise gate
+        map_samples(samples, frame->nb_samples, [&](float sample) {
+            // Apply noise gate
+            if (std::fabs(sample) < noise_gate_threshold) {
+                return 0.0f;  // Mute if below threshold
             }
-        }
-    }
+            max_sample_value = std::max(max_sample_value, std::fabs(sample));
+            return sample;
+        });
+
+        // Calculate the normalization factor
+        float normalization_factor = (max_sample_value > 0) ? target_level / max_sample_value : 1.0f;
+
+        // Second pass: normalize samples
+        map_samples(samples, frame->nb_samples, [&](float sample) {
+            return std::clamp(sample * normalization_factor, -1.0f, 1.0f);
+        });
+    });
 }
 
 
@@ -552,68 +346,49 @@ float calculate_average_noise_level(AVFrame* frame, enum AVSampleFormat format)
     float total_noise = 0.0f;
     int sample_count = 0;
 
-    for (int i = 0; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* sample = (float*)frame->data[ch] + i;
-                    total_noise += std::fabs(*sample);
-                    sample_count++;
-                    break;
-                }
-                case AV_SAMPLE_FMT_S16:
-                case AV_SAMPLE_FMT_S16P: {
-                    int16_t* sample = (int16_t*)frame->data[ch] + i;
-                    total_noise += std::fabs(static_cast<float>(*sample));
-                    sample_count++;
-                    break;
-                }
-                case AV_SAMPLE_FMT_S32:
-                case AV_SAMPLE_FMT_S32P: {
-                    int32_t* sample = (int32_t*)frame->data[ch] + i;
-                    total_noise += std::fabs(static_cast<float>(*sample));
-                    sample_count++;
-                    break;
-                }
-                default:
-                    break;
+    visit_samples(frame, format, [&](auto samples) {
+        for (int p = 0; p < samples.planes(); p++) {
+            auto* data = samples.plane(p);
+            for (int i = 0; i < samples.plane_size(frame->nb_samples); i++) {
+                total_noise += std::fabs(samples.read(data[i]));
             }
         }
-    }
+        sample_count = frame->nb_samples * samples.channels;
+    });
 
     return (sample_count > 0) ? total_noise / sample_count : 0.0f;
 }
 
 
 // Process audio frame using OpenMP for parallel processing
-void process_audio_frame(AVFrame* frame, enum AVSampleFormat format) {
+void process_audio_frame(StreamEffects& effects, AVFrame* frame, enum AVSampleFormat format) {
     float bass_gain = 1.01f;  // Adjust bass gain
     float treble_gain = 1.02f;  // Adjust treble gain
     float compression_threshold = 0.7f;  // Adjust threshold
     float compression_ratio = 2.0f;  // Adjust higher ratio
-    float decay_factor = 0.1f;  // decay for subtle reverb
-    int delay_samples = 441;  // Reverb delay
+    float decay_factor = 0.1f;  // Level of the reverb mixed in
+    float room_seconds = 0.5f;  // Length of the room's impulse response
+    float room_rt60 = 0.4f;  // Seconds for the reverb tail to fall by 60 dB
     float volume_gain = 2.0f;  //  volume gain
-    float noise_threshold = 0.01f;  // Adjust noise threshold 
-    float low_cutoff = 14000.0f;  // Cut off low bands
-    float high_cutoff = 17000.0f;  // Cut off highs
-    int window = 10; //smoothening factor
+    float low_cutoff = 80.0f;  // Cut off rumble below this many Hz
+    float high_cutoff = 15000.0f;  // Cut off hiss above this many Hz
+    float bandpass_gain = 0.1f;  // Level the band-pass leaves the signal at
 	float target_level = 0.1f; 
 	float noise_reduction_multiplier = 1.4f;
 	float silence_threshold = 0.2f;
 	
-	//mute_silent_sections(frame,format,silence_threshold, window);
-	apply_bandpass_filter(frame,format,low_cutoff,high_cutoff);
-	apply_compression(frame, format, compression_threshold, compression_ratio);
-	
-	adjust_volume(frame, format, volume_gain);
-   	adjust_volume(frame, format, volume_gain);
-    
-    apply_equalizer(frame, format, bass_gain, treble_gain);
-   	
-    apply_reverb(frame, format, decay_factor, delay_samples);
-    noise_reduction(frame, format, noise_threshold,window);
+	//mute_silent_sections(frame,format,silence_threshold, kNoiseWindow);
+	// Compression and the volume boosts are point-wise and run as one pass;
+	// the filters, reverb and noise reduction carry state along each channel,
+	// so each gets a pass of its own
+	run_effect_chain(frame, format,
+	    frame_stage([&](AVFrame* f, enum AVSampleFormat fmt) { apply_bandpass_filter(effects.bandpass, f, fmt, low_cutoff, high_cutoff, bandpass_gain); }),
+	    Compressor{compression_threshold, compression_ratio},
+	    Gain{volume_gain},
+	    Gain{volume_gain},
+	    frame_stage([&](AVFrame* f, enum AVSampleFormat fmt) { apply_equalizer(effects.equalizer, f, fmt, bass_gain, treble_gain); }),
+	    frame_stage([&](AVFrame* f, enum AVSampleFormat fmt) { apply_reverb(effects.reverb, f, fmt, decay_factor, room_seconds, room_rt60); }),
+	    frame_stage([&](AVFrame* f, enum AVSampleFormat fmt) { noise_reduction(effects.smoother, f, fmt, kNoiseThreshold, kNoiseWindow); }));
     //adjust_volume(frame, format, volume_gain);
     
  
@@ -622,6 +397,7 @@ void process_audio_frame(AVFrame* frame, enum AVSampleFormat format) {
 // Decode audio frames
 int decode_audio(AVFormatContext* input_format_ctx, AVCodecContext* decoder_ctx, int audio_stream_index, SwrContext* swr_ctx, AVCodecContext* encoder_ctx, AVStream* out_stream, AVFormatContext* output_format_ctx) {
     AVPacket* input_packet = av_packet_alloc();
+    AVPacket* output_packet = av_packet_alloc(); // Reused for every encoded packet
     AVFrame* input_frame = av_frame_alloc();
     AVFrame* resampled_frame = av_frame_alloc();
     resampled_frame->nb_samples = encoder_ctx->frame_size;
@@ -630,6 +406,29 @@ int decode_audio(AVFormatContext* input_format_ctx, AVCodecContext* decoder_ctx,
     av_frame_get_buffer(resampled_frame, 0);
 
     int64_t pts = 0;
+    StreamEffects effects;
+
+    // Sends resampled_frame to the encoder and writes out the packets it
+    // hands back
+    auto encode_resampled = [&]() {
+        resampled_frame->pts = pts;
+        pts += resampled_frame->nb_samples;
+
+        if (avcodec_send_frame(encoder_ctx, resampled_frame) < 0) {
+            std::cerr << "Error sending frame to encoder" << std::endl;
+            return false;
+        }
+
+        while (avcodec_receive_packet(encoder_ctx, output_packet) == 0) {
+            output_packet->stream_index = 0;
+            av_packet_rescale_ts(output_packet, encoder_ctx->time_base, out_stream->time_base);
+            if (av_interleaved_write_frame(output_format_ctx, output_packet) < 0) {
+                std::cerr << "Error writing output packet" << std::endl;
+                return false;
+            }
+        }
+        return true;
+    };
 
     while (av_read_frame(input_format_ctx, input_packet) >= 0) {
         if (input_packet->stream_index == audio_stream_index) {
@@ -639,36 +438,48 @@ int decode_audio(AVFormatContext* input_format_ctx, AVCodecContext* decoder_ctx,
             }
 
             while (avcodec_receive_frame(decoder_ctx, input_frame) == 0) {
-                process_audio_frame(input_frame, decoder_ctx->sample_fmt); // Process frame
+                process_audio_frame(effects, input_frame, decoder_ctx->sample_fmt); // Process frame
 
                 // Resample
                 swr_convert(swr_ctx, resampled_frame->data, resampled_frame->nb_samples,
                             (const uint8_t**)input_frame->data, input_frame->nb_samples);
 
-                resampled_frame->pts = pts;
-                pts += resampled_frame->nb_samples;
-
-                if (avcodec_send_frame(encoder_ctx, resampled_frame) < 0) {
-                    std::cerr << "Error sending frame to encoder" << std::endl;
+                if (!encode_resampled()) {
                     return 1;
                 }
-
-                AVPacket* output_packet = av_packet_alloc();
-                while (avcodec_receive_packet(encoder_ctx, output_packet) == 0) {
-                    output_packet->stream_index = 0;
-                    av_packet_rescale_ts(output_packet, encoder_ctx->time_base, out_stream->time_base);
-                    if (av_interleaved_write_frame(output_format_ctx, output_packet) < 0) {
-                        std::cerr << "Error writing output packet" << std::endl;
-                        return 1;
-                    }
-                }
-                av_packet_free(&output_packet);
             }
         }
         av_packet_unref(input_packet);
     }
 
+    // Noise reduction holds its last samples back (the window looks ahead);
+    // run them out as one short final frame before the encoder is drained
+    if (effects.smoother.latency() > 0 && effects.smoother.channels() == decoder_ctx->ch_layout.nb_channels) {
+        AVFrame* tail_frame = av_frame_alloc();
+        tail_frame->nb_samples = effects.smoother.latency();
+        tail_frame->format = decoder_ctx->sample_fmt;
+        tail_frame->sample_rate = decoder_ctx->sample_rate;
+        av_channel_layout_copy(&tail_frame->ch_layout, &decoder_ctx->ch_layout);
+        if (av_frame_get_buffer(tail_frame, 0) < 0) {
+            std::cerr << "Error allocating the final frame" << std::endl;
+            av_frame_free(&tail_frame);
+            return 1;
+        }
+        flush_noise_reduction(effects.smoother, tail_frame, decoder_ctx->sample_fmt, kNoiseThreshold);
+
+        int converted = swr_convert(swr_ctx, resampled_frame->data, resampled_frame->nb_samples,
+                                    (const uint8_t**)tail_frame->data, tail_frame->nb_samples);
+        av_frame_free(&tail_frame);
+        if (converted > 0) {
+            resampled_frame->nb_samples = converted; // The last frame may be short
+            if (!encode_resampled()) {
+                return 1;
+            }
+        }
+    }
+
     av_packet_free(&input_packet);
+    av_packet_free(&output_packet);
     av_frame_free(&input_frame);
     av_frame_free(&resampled_frame);
 
@@ -744,6 +555,10 @@ int main(int argc, char* argv[]) {
     encoder_ctx->sample_rate = decoder_ctx->sample_rate;
     encoder_ctx->ch_layout = decoder_ctx->ch_layout;
     encoder_ctx->bit_rate = 192000;
+    // Encoded payloads come from a recycled buffer pool instead of a fresh
+    // allocation per packet
+    PacketPool packet_pool;
+    packet_pool.attach_encoder(encoder_ctx);
     avcodec_open2(encoder_ctx, encoder, nullptr);
 
     // Initialize output format context
@@ -0,0 +1,217 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Pins worker threads to cores or NUMA nodes so a pipeline's threads stay
+// next to the caches and memory they share, instead of drifting across
+// sockets under load.
+//
+// Policies, for threads numbered 0..count-1 in the order the program hands
+// them out (pipeline order, or OpenMP thread number):
+//   none     leave placement to the scheduler
+//   compact  one core each, filling a node before moving to the next
+//   spread   one core each, alternating between nodes
+//   numa     the whole of one node each; consecutive threads share a node,
+//            and the threads are split evenly over the nodes
+// Only CPUs the process may run on (taskset, cgroups) are used. Without NUMA
+// information in sysfs all of them count as one node.
+enum class AffinityPolicy { none, compact, spread, numa };
+
+// Environment variable consulted when the command line does not pick a policy
+inline const char *affinity_env_var() { return "PARALLEL_FFMPEG_AFFINITY"; }
+
+inline bool parse_affinity_policy(const char *name, AffinityPolicy &policy) {
+    static const struct { const char *name; AffinityPolicy policy; } policies[] = {
+        {"none", AffinityPolicy::none},
+        {"compact", AffinityPolicy::compact},
+        {"spread", AffinityPolicy::spread},
+        {"numa", AffinityPolicy::numa},
+    };
+    for (const auto& entry : policies) {
+        if (strcmp(name, entry.name) == 0) {
+            policy = entry.policy;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The policy named by the environment, none if unset or not understood
+inline AffinityPolicy affinity_policy_from_env() {
+    AffinityPolicy policy = AffinityPolicy::none;
+    const char *value = getenv(affinity_env_var());
+    if (value && !parse_affinity_policy(value, policy)) {
+        std::cerr << "Ignoring unknown " << affinity_env_var() << "=" << value << std::endl;
+    }
+    return policy;
+}
+
+class CpuPlacement {
+public:
+    // Reads the topology and the process's allowed CPUs; construct it before
+    // any thread has been pinned
+    CpuPlacement(AffinityPolicy policy, int thread_count) : policy_(policy), thread_count_(thread_count) {
+        if (policy_ == AffinityPolicy::none) {
+            return;
+        }
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            std::cerr << "Could not read CPU affinity, threads are not pinned" << std::endl;
+            policy_ = AffinityPolicy::none;
+            return;
+        }
+
+        DIR *dir = opendir("/sys/devices/system/node");
+        struct dirent *entry;
+        while (dir && (entry = readdir(dir))) {
+            int node;
+            if (sscanf(entry->d_name, "node%d", &node) != 1) {
+                continue;
+            }
+            std::string path = std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist";
+            std::vector<int> cpus = allowed_cpus(read_cpu_list(path.c_str()), allowed);
+            if (!cpus.empty()) {
+                nodes_.push_back(cpus);
+            }
+        }
+        if (dir) {
+            closedir(dir);
+        }
+        if (nodes_.empty()) {
+            std::vector<int> cpus;
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    cpus.push_back(cpu);
+                }
+            }
+            nodes_.push_back(cpus);
+        }
+        // readdir() order is arbitrary; keep nodes in CPU order
+        std::sort(nodes_.begin(), nodes_.end());
+    }
+
+    AffinityPolicy policy() const { return policy_; }
+    size_t node_count() const { return nodes_.size(); }
+
+    // CPUs thread i may run on; empty means unrestricted
+    std::vector<int> cpus_for(int i) const {
+        if (policy_ == AffinityPolicy::none || nodes_.empty() || i < 0) {
+            return {};
+        }
+        size_t node_count = nodes_.size();
+        switch (policy_) {
+            case AffinityPolicy::compact: {
+                size_t total = 0;
+                for (const auto& node : nodes_) {
+                    total += node.size();
+                }
+                size_t slot = i % total;
+                for (const auto& node : nodes_) {
+                    if (slot < node.size()) {
+                        return {node[slot]};
+                    }
+                    slot -= node.size();
+                }
+                return {};
+            }
+            case AffinityPolicy::spread: {
+                const std::vector<int> &node = nodes_[i % node_count];
+                return {node[(i / node_count) % node.size()]};
+            }
+            case AffinityPolicy::numa: {
+                size_t count = thread_count_ > i ? thread_count_ : i + 1;
+                return nodes_[(size_t)i * node_count / count];
+            }
+            default:
+                return {};
+        }
+    }
+
+    // Pins the calling thread as thread i. False (with a message) if the
+    // kernel refused; the thread then keeps running wherever it was.
+    bool pin_current_thread(int i) const {
+        std::vector<int> cpus = cpus_for(i);
+        if (cpus.empty()) {
+            return true;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) {
+            CPU_SET(cpu, &set);
+        }
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (ret != 0) {
+            std::cerr << "Could not pin thread " << i << ": " << strerror(ret) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+#ifdef _OPENMP
+    // Pins the threads of an OpenMP team of the given size, each by its
+    // thread number. The runtime keeps its threads between regions, so later
+    // teams of the same size run on the same, now pinned, threads.
+    void pin_omp_team(int team_size) const {
+        if (policy_ == AffinityPolicy::none) {
+            return;
+        }
+        #pragma omp parallel num_threads(team_size)
+        pin_current_thread(omp_get_thread_num());
+    }
+#endif
+
+private:
+    // Parses a sysfs CPU list such as "0-3,8-11"
+    static std::vector<int> read_cpu_list(const char *path) {
+        std::vector<int> cpus;
+        FILE *file = fopen(path, "r");
+        if (!file) {
+            return cpus;
+        }
+        int first, last;
+        char separator = ',';
+        while (separator == ',' && fscanf(file, "%d", &first) == 1) {
+            last = first;
+            if (fscanf(file, "%c", &separator) == 1 && separator == '-') {
+                if (fscanf(file, "%d", &last) != 1 || fscanf(file, "%c", &separator) != 1) {
+                    separator = '\n';
+                }
+            }
+            for (int cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        }
+        fclose(file);
+        return cpus;
+    }
+
+    static std::vector<int> allowed_cpus(const std::vector<int> &cpus, const cpu_set_t &allowed) {
+        std::vector<int> result;
+        for (int cpu : cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                result.push_back(cpu);
+            }
+        }
+        return result;
+    }
+
+    AffinityPolicy policy_;
+    int thread_count_;
+    std::vector<std::vector<int>> nodes_;
+};
+
+#endif
@@ -6,6 +6,8 @@ extern "C" {
     #include <libswresample/swresample.h>
     #include <libavutil/opt.h>
 }
+#include "FramePool.h"
+#include "PacketPool.h"
 
 void decode_audio(AVCodecContext *dec_ctx, AVFrame *frame, AVPacket *pkt) {
     int ret = avcodec_send_packet(dec_ctx, pkt);
@@ -28,25 +30,19 @@ void decode_audio(AVCodecContext *dec_ctx, AVFrame *frame, AVPacket *pkt) {
     }
 }
 
-void encode_audio(AVCodecContext *enc_ctx, AVFrame *frame, AVFormatContext *output_fmt_ctx) {
+// pkt is the caller's output packet, reused for every encoded packet
+void encode_audio(AVCodecContext *enc_ctx, AVFrame *frame, AVFormatContext *output_fmt_ctx, AVPacket *pkt) {
     int ret = avcodec_send_frame(enc_ctx, frame);
     if (ret < 0) {
         std::cerr << "Error sending frame for encoding: " << std::endl;
         return;
     }
 
-    AVPacket *pkt = av_packet_alloc();
-    if (!pkt) {
-        std::cerr << "Could not allocate AVPacket" << std::endl;
-        return;
-    }
-
     while (ret >= 0) {
         ret = avcodec_receive_packet(enc_ctx, pkt);
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) break;
         if (ret < 0) {
             std::cerr << "Error during encoding: " << std::endl;
-            av_packet_free(&pkt);
             return;
         }
 
@@ -56,14 +52,11 @@ void encode_audio(AVCodecContext *enc_ctx, AVFrame *frame, AVFormatContext *outp
         if (ret < 0) {
             std::cerr << "Error writing encoded packet to output" << std::endl;
             av_packet_unref(pkt);
-            av_packet_free(&pkt);
             return;
         }
 
         av_packet_unref(pkt);
     }
-
-    av_packet_free(&pkt);
 }
 
 void process_audio(const std::string &input_file, const std::string &output_file) {
@@ -142,6 +135,11 @@ void process_audio(const std::string &input_file, const std::string &output_file
     enc_ctx->channels = av_get_channel_layout_nb_channels(enc_ctx->channel_layout);
     enc_ctx->sample_fmt = encoder->sample_fmts[0];
 
+    // Encoded payloads come from a recycled buffer pool instead of a fresh
+    // allocation per packet
+    PacketPool packet_pool;
+    packet_pool.attach_encoder(enc_ctx);
+
     if (avcodec_open2(enc_ctx, encoder, nullptr) < 0) {
         std::cerr << "Failed to open encoder" << std::endl;
         avcodec_free_context(&enc_ctx);
@@ -243,27 +241,42 @@ void process_audio(const std::string &input_file, const std::string &output_file
         return;
     }
 
+    AVPacket *output_pkt = av_packet_alloc(); // Reused for every encoded packet
+    if (!output_pkt) {
+        std::cerr << "Could not allocate AVPacket" << std::endl;
+        av_packet_free(&pkt);
+        av_frame_free(&frame);
+        avio_closep(&output_fmt_ctx->pb);
+        avformat_free_context(output_fmt_ctx);
+        avcodec_free_context(&enc_ctx);
+        avcodec_free_context(&dec_ctx);
+        swr_free(&swr_ctx);
+        avformat_close_input(&fmt_ctx);
+        return;
+    }
+
     while (av_read_frame(fmt_ctx, pkt) >= 0) {
         if (pkt->stream_index == stream_index) {
             decode_audio(dec_ctx, frame, pkt);
 
             if (frame->nb_samples > 0) {
-                AVFrame *resampled_frame = av_frame_alloc();
-                resampled_frame->channel_layout = enc_ctx->channel_layout;
-                resampled_frame->format = enc_ctx->sample_fmt;
-                resampled_frame->sample_rate = enc_ctx->sample_rate;
-                resampled_frame->nb_samples = frame->nb_samples;
-
-                av_frame_get_buffer(resampled_frame, 0);
+                // Recycled from the pool, so steady state allocates nothing here
+                AVFrame *resampled_frame = shared_frame_pool().get(enc_ctx->sample_fmt, enc_ctx->ch_layout,
+                                                                   enc_ctx->sample_rate, frame->nb_samples);
+                if (!resampled_frame) {
+                    std::cerr << "Could not allocate resampled frame" << std::endl;
+                    av_packet_unref(pkt);
+                    break;
+                }
 
                 swr_convert(swr_ctx, resampled_frame->data, resampled_frame->nb_samples,
             (const uint8_t **)frame->data, frame->nb_samples);
 
 				// Encode the resampled frame
-			encode_audio(enc_ctx, resampled_frame, output_fmt_ctx);
+			encode_audio(enc_ctx, resampled_frame, output_fmt_ctx, output_pkt);
  
 
-                av_frame_free(&resampled_frame);
+                shared_frame_pool().put(resampled_frame);
             }
         }
         av_packet_unref(pkt);
@@ -273,6 +286,7 @@ void process_audio(const std::string &input_file, const std::string &output_file
 
     av_frame_free(&frame);
     av_packet_free(&pkt);
+    av_packet_free(&output_pkt);
     avio_closep(&output_fmt_ctx->pb);
     avformat_free_context(output_fmt_ctx);
     avcodec_free_context(&enc_ctx);
@@ -13,354 +13,184 @@ extern "C" {
     #include <libavutil/channel_layout.h>
     #include <libavutil/samplefmt.h>
 }
-//equaliser to  enhance clarity, bass, or treble as desired. 
-void apply_equalizer(AVFrame* frame, enum AVSampleFormat format, float bass_gain, float treble_gain) {
-    
-    #pragma omp parallel for schedule(static, 288)
-    for (int i = 0; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* sample = (float*)frame->data[ch] + i;
-                    if (*sample < 100.0f && *sample>=50.0f) {  // Apply bass gain for low frequencies
-                        *sample *= bass_gain;
-                    } 
-                    else if (*sample > 5000.0f) {  // Apply treble gain for high frequencies
-                        *sample *= treble_gain;
-                    }
-                    *sample = std::clamp(*sample, -1.0f, 1.0f);
-                    break;
-                }
-                default:
-                    break;
-            }
-        }
+#include "PacketPool.h"
+#include "Affinity.h"
+#include "SampleFormat.h"
+#include "SimdKernels.h"
+#include "Biquad.h"
+#include "Reverb.h"
+#include "SlidingWindow.h"
+
+// Threads in the OpenMP team each effect spreads a frame's work over
+const int kEffectTeamSize = 2;
+
+// Filter state that carries from one frame of the stream to the next
+struct StreamEffects {
+    BiquadBank bandpass;
+    BiquadBank equalizer;
+    Reverb reverb;
+    SlidingWindow smoother;
+};
+//equaliser to  enhance clarity, bass, or treble as desired: shelves below
+//100 Hz and above 5 kHz, gains linear
+void apply_equalizer(BiquadBank& equalizer, AVFrame* frame, enum AVSampleFormat format, float bass_gain, float treble_gain) {
+    int channels = frame->ch_layout.nb_channels;
+    if (frame->sample_rate <= 0) {
+        return;
+    }
+    if (!equalizer.configured_for(frame->sample_rate, channels)) {
+        equalizer.configure(design_equalizer(frame->sample_rate, 100.0, bass_gain, 5000.0, treble_gain), channels, frame->sample_rate);
     }
+    visit_samples(frame, format, [&](auto samples) {
+        equalizer.process(samples, frame->nb_samples);
+    });
 }
 //Compression reduces the volume of louder sounds and increases the volume of quieter sounds, which can help maintain consistency and make softer sounds more audible.
 void apply_compression(AVFrame* frame, enum AVSampleFormat format, float threshold, float ratio) {
-	
-    #pragma omp parallel for schedule(static, 288)
-    for (int i = 0; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* sample = (float*)frame->data[ch] + i;
-                    if (std::abs(*sample) > threshold) {
-                        *sample = threshold + (*sample - threshold) / ratio;
-                    }
-                    *sample = std::clamp(*sample, -1.0f, 1.0f);
-                    break;
-                }
-                default:
-                    break;
-            }
+    const SimdKernels &kernels = simd_kernels();
+    visit_samples(frame, format, [&](auto samples) {
+        for (int p = 0; p < samples.planes(); p++) {
+            simd_map(samples.plane(p), samples.plane_size(frame->nb_samples), [&](float* block, int n) {
+                kernels.compress_clamp(block, n, threshold, ratio);
+            });
         }
-    }
+    });
 }
-//Adding a subtle reverb can enhance the audio's natural quality
-void apply_reverb(AVFrame* frame, enum AVSampleFormat format, float decay_factor, int delay_samples) {
-    
-    #pragma omp parallel for schedule(static, 288)
-    for (int i = delay_samples; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* current_sample = (float*)frame->data[ch] + i;
-                    float* delayed_sample = (float*)frame->data[ch] + i - delay_samples;
-                    *current_sample += (*delayed_sample) * decay_factor;
-                    *current_sample = std::clamp(*current_sample, -1.0f, 1.0f);
-                    break;
-                }
-                default:
-                    break;
-            }
-        }
+//Adding a subtle reverb can enhance the audio's natural quality. Channels
+//are independent, so the team splits them.
+void apply_reverb(Reverb& reverb, AVFrame* frame, enum AVSampleFormat format, float wet_level, float room_size) {
+    int channels = frame->ch_layout.nb_channels;
+    if (frame->sample_rate <= 0) {
+        return;
+    }
+    if (!reverb.configured_for(frame->sample_rate, channels)) {
+        reverb.configure(channels, frame->sample_rate, room_size);
     }
+    visit_samples(frame, format, [&](auto samples) {
+        #pragma omp parallel for schedule(static, 1)
+        for (int ch = 0; ch < channels; ch++) {
+            reverb.process_channel(samples, ch, frame->nb_samples, 1.0f, wet_level);
+        }
+    });
 }
 
-void apply_bandpass_filter(AVFrame* frame, enum AVSampleFormat format, float low_cutoff, float high_cutoff) {
-    
-    #pragma omp parallel for schedule(static, 288)
-    for (int i = 0; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* sample = (float*)frame->data[ch] + i;
-
-                    // Frequencies below low_cutoff are reduced (bass cut)
-                    if (*sample < low_cutoff) {
-                        *sample *= 0.1f; // Reduce bass frequencies drastically
-                    }
-                    
-                    // Frequencies above high_cutoff are reduced (treble cut)
-                    else if (*sample > high_cutoff) {
-                        *sample *= 0.1f; // Reduce high frequencies drastically
-                    }
-                    
-                    // Clamp values to avoid distortion
-                    *sample = std::clamp(*sample, -1.0f, 1.0f);
-                    break;
-                }
-                default:
-                    break;
-            }
-        }
+// Band-limits to low_cutoff..high_cutoff Hz (4th-order Butterworth on each
+// side), scaled by passband_gain
+void apply_bandpass_filter(BiquadBank& bandpass, AVFrame* frame, enum AVSampleFormat format, float low_cutoff, float high_cutoff, float passband_gain) {
+    int channels = frame->ch_layout.nb_channels;
+    if (frame->sample_rate <= 0) {
+        return;
     }
+    if (!bandpass.configured_for(frame->sample_rate, channels)) {
+        bandpass.configure(design_bandpass(frame->sample_rate, low_cutoff, high_cutoff, passband_gain), channels, frame->sample_rate);
+    }
+    visit_samples(frame, format, [&](auto samples) {
+        bandpass.process(samples, frame->nb_samples);
+    });
 }
 
 //adjust volume
 void adjust_volume(AVFrame* frame, enum AVSampleFormat format, float gain){
-    
-    #pragma omp parallel for schedule(static, 288)
-    for (int i = 0; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            // Adjust volume
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* sample = (float*)frame->data[ch] + i;
-                    *sample *= gain;
-                    *sample = std::clamp(*sample, -1.0f, 1.0f);
-                    break;
-                }
-                case AV_SAMPLE_FMT_S16:
-                case AV_SAMPLE_FMT_S16P: {
-                    int16_t* sample = (int16_t*)frame->data[ch] + i;
-                    int32_t temp = *sample * gain;
-                    *sample = std::clamp(temp, (int32_t)INT16_MIN, (int32_t)INT16_MAX);
-                    break;
-                }
-                case AV_SAMPLE_FMT_S32:
-                case AV_SAMPLE_FMT_S32P: {
-                    int32_t* sample = (int32_t*)frame->data[ch] + i;
-                    int64_t temp = *sample * gain;
-                    *sample = std::clamp(temp, (int64_t)INT32_MIN, (int64_t)INT32_MAX);
-                    break;
-                }
-                default:
-                    break;
-            }
+    const SimdKernels &kernels = simd_kernels();
+    visit_samples(frame, format, [&](auto samples) {
+        for (int p = 0; p < samples.planes(); p++) {
+            simd_map(samples.plane(p), samples.plane_size(frame->nb_samples), [&](float* block, int n) {
+                kernels.gain_clamp(block, n, gain, -1.0f, 1.0f);
+            });
         }
-    }
+    });
 }
 
-void noise_reduction(AVFrame* frame, enum AVSampleFormat format, float noise_threshold, int window_size) {
+// Moving average over window_size samples (a running sum, carried across
+// frames; output trails input by window_size / 2 samples), then a gate
+void noise_reduction(SlidingWindow& smoother, AVFrame* frame, enum AVSampleFormat format, float noise_threshold, int window_size) {
     // Ensure the window size is odd to center the average around the current sample
     if (window_size % 2 == 0) {
         window_size++;
     }
     
     int half_window = window_size / 2;
+    int channels = frame->ch_layout.nb_channels;
+    if (!smoother.configured_for(SlidingWindow::Kernel::boxcar, half_window, channels)) {
+        smoother.configure(SlidingWindow::Kernel::boxcar, half_window, channels);
+    }
     
-    #pragma omp parallel for simd
-    for (int i = 0; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            float smoothed_sample = 0.0f;
-            int count = 0;
-
-            // Gather samples from the window
-            for (int j = -half_window; j <= half_window; j++) {
-                int index = i + j;
-                if (index >= 0 && index < frame->nb_samples) {
-                    switch (format) {
-                        case AV_SAMPLE_FMT_FLT:
-                        case AV_SAMPLE_FMT_FLTP: {
-                            float* sample = (float*)frame->data[ch] + index;
-                            smoothed_sample += *sample;
-                            count++;
-                            break;
-                        }
-                        case AV_SAMPLE_FMT_S16:
-                        case AV_SAMPLE_FMT_S16P: {
-                            int16_t* sample = (int16_t*)frame->data[ch] + index;
-                            smoothed_sample += static_cast<float>(*sample);
-                            count++;
-                            break;
-                        }
-                        case AV_SAMPLE_FMT_S32:
-                        case AV_SAMPLE_FMT_S32P: {
-                            int32_t* sample = (int32_t*)frame->data[ch] + index;
-                            smoothed_sample += static_cast<float>(*sample);
-                            count++;
-                            break;
-                        }
-                        default:
-                            break;
-                    }
-                }
-            }
-
-            // Average the collected samples
-            if (count > 0) {
-                smoothed_sample /= count;
-            }
-
-            // Apply noise reduction based on the noise threshold
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* sample = (float*)frame->data[ch] + i;
-                    if (std::fabs(smoothed_sample) < noise_threshold) {
-                        *sample = 0.0f; // Set to zero if below threshold
-                    } else {
-                        *sample = smoothed_sample; // Set to smoothed value
-                    }
-                    break;
-                }
-                case AV_SAMPLE_FMT_S16:
-                case AV_SAMPLE_FMT_S16P: {
-                    int16_t* sample = (int16_t*)frame->data[ch] + i;
-                    if (std::abs(static_cast<int16_t>(smoothed_sample)) < static_cast<int16_t>(noise_threshold * INT16_MAX)) {
-                        *sample = 0; // Set to zero if below threshold
-                    } else {
-                        *sample = std::clamp(static_cast<int16_t>(smoothed_sample), static_cast<int16_t>(INT16_MIN), static_cast<int16_t>(INT16_MAX)); // Clamp to valid range
-                    }
-                    break;
-                }
-                case AV_SAMPLE_FMT_S32:
-                case AV_SAMPLE_FMT_S32P: {
-                    int32_t* sample = (int32_t*)frame->data[ch] + i;
-                    if (std::abs(static_cast<int32_t>(smoothed_sample)) < static_cast<int32_t>(noise_threshold * INT32_MAX)) {
-                        *sample = 0; // Set to zero if below threshold
-                    } else {
-                        *sample = std::clamp(static_cast<int32_t>(smoothed_sample), static_cast<int32_t>(INT32_MIN), static_cast<int32_t>(INT32_MAX)); // Clamp to valid range
-                    }
-                    break;
-                }
-                default:
-                    break;
-            }
+    visit_samples(frame, format, [&](auto samples) {
+        #pragma omp parallel for schedule(static, 1)
+        for (int ch = 0; ch < channels; ch++) {
+            smoother.process_channel(samples, ch, frame->nb_samples, [&](float smoothed_sample) {
+                // Apply noise reduction based on the noise threshold
+                return std::fabs(smoothed_sample) < noise_threshold ? 0.0f : smoothed_sample;
+            });
         }
-    }
+    });
 }
 
 
 
 
 void normalize_audio(AVFrame* frame, enum AVSampleFormat format, float target_level) {
-    float max_sample_value = 0.0f;
-
-    // First pass: find the maximum sample value
-    #pragma omp parallel for reduction(max:max_sample_value)
-    for (int i = 0; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* sample = (float*)frame->data[ch] + i;
-                    max_sample_value = std::max(max_sample_value, std::fabs(*sample));
-                    break;
-                }
-                case AV_SAMPLE_FMT_S16:
-                case AV_SAMPLE_FMT_S16P: {
-                    int16_t* sample = (int16_t*)frame->data[ch] + i;
-                    max_sample_value = std::max(max_sample_value, std::fabs(static_cast<float>(*sample))); // Cast to float for comparison
-                    break;
-                }
-                case AV_SAMPLE_FMT_S32:
-                case AV_SAMPLE_FMT_S32P: {
-                    int32_t* sample = (int32_t*)frame->data[ch] + i;
-                    max_sample_value = std::max(max_sample_value, std::fabs(static_cast<float>(*sample))); // Cast to float for comparison
-                    break;
-                }
-                default:
-                    break;
+    visit_samples(frame, format, [&](auto samples) {
+        float max_sample_value = 0.0f;
+
+        // First pass: find the maximum sample value
+        for (int p = 0; p < samples.planes(); p++) {
+            auto* data = samples.plane(p);
+            #pragma omp parallel for reduction(max:max_sample_value)
+            for (int i = 0; i < samples.plane_size(frame->nb_samples); i++) {
+                max_sample_value = std::max(max_sample_value, std::fabs(samples.read(data[i])));
             }
         }
-    }
 
-    // Calculate the normalization factor
-    float normalization_factor = (max_sample_value > 0) ? target_level / max_sample_value : 1.0f;
-
-    // Second pass: normalize samples
-    #pragma omp parallel for
-    for (int i = 0; i < frame->nb_samples; i++) {
-        for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-            switch (format) {
-                case AV_SAMPLE_FMT_FLT:
-                case AV_SAMPLE_FMT_FLTP: {
-                    float* sample = (float*)frame->data[ch] + i;
-                    *sample *= normalization_factor; // Scale sample
-                    *sample = std::clamp(*sample, -1.0f, 1.0f); // Clamp to float range
-                    break;
-                }
-                case AV_SAMPLE_FMT_S16:
-                case AV_SAMPLE_FMT_S16P: {
-                    int16_t* sample = (int16_t*)frame->data[ch] + i;
-                    *sample = std::clamp(static_cast<int16_t>(*sample * normalization_factor), 
-                                         static_cast<int16_t>(INT16_MIN), 
-                                         static_cast<int16_t>(INT16_MAX)); // Scale sample
-                    break;
-                }
-                case AV_SAMPLE_FMT_S32:
-                case AV_SAMPLE_FMT_S32P: {
-                    int32_t* sample = (int32_t*)frame->data[ch] + i;
-                    *sample = std::clamp(static_cast<int32_t>(*sample * normalization_factor), 
-                                         static_cast<int32_t>(INT32_MIN), 
-                                         static_cast<int32_t>(INT32_MAX)); // Scale sample
-                    break;
-                }
-                default:
-                    break;
+        // Calculate the normalization factor
+        float normalization_factor = (max_sample_value > 0) ? target_level / max_sample_value : 1.0f;
+
+        // Second pass: normalize samples
+        for (int p = 0; p < samples.planes(); p++) {
+            auto* data = samples.plane(p);
+            #pragma omp parallel for
+            for (int i = 0; i < samples.plane_size(frame->nb_samples); i++) {
+                data[i] = samples.write(std::clamp(samples.read(data[i]) * normalization_factor, -1.0f, 1.0f));
             }
         }
-    }
+    });
 }
 
 
-// Process audio frame using OpenMP for parallel processing
-void process_audio_frame(AVFrame* frame, enum AVSampleFormat format) {
+// Process audio frame using OpenMP for parallel processing. The effects run
+// one after another, each reading what the previous one wrote; the
+// parallelism is inside each effect (blocks of samples, or channels).
+void process_audio_frame(StreamEffects& effects, AVFrame* frame, enum AVSampleFormat format) {
     float bass_gain = 1.05f;  // Adjust bass gain
     float treble_gain = 1.08f;  // Adjust treble gain
     float compression_threshold = 0.7f;  // Adjust threshold
     float compression_ratio = 2.0f;  // Adjust higher ratio
-    float decay_factor = 0.1f;  // decay for subtle reverb
-    int delay_samples = 441;  // Reverb delay
+    float decay_factor = 0.1f;  // Level of the subtle reverb mixed in
+    float room_size = 0.5f;  // Reverb tail length, 0 to 1
     float volume_gain = 1.2f;  //  volume gain
     float noise_threshold = 0.01f;  // Adjust noise threshold 
-    float low_cutoff = 500.0f;  // Cut off low bands
-    float high_cutoff = 15000.0f;  // Cut off highs
+    float low_cutoff = 80.0f;  // Cut off rumble below this many Hz
+    float high_cutoff = 15000.0f;  // Cut off hiss above this many Hz
+    float bandpass_gain = 0.1f;  // Level the band-pass leaves the signal at
     int window = 5; //smoothening factor
 	
-	omp_set_num_threads(2);
+	omp_set_num_threads(kEffectTeamSize);
 	
-	#pragma omp parallel
-	{
-		#pragma omp single
-		{
-		    #pragma omp task
-		    {
-		    apply_bandpass_filter(frame,format,low_cutoff,high_cutoff);
-    		adjust_volume(frame, format, volume_gain); 
-			}
-		    #pragma omp task
-		    {
-		    apply_compression(frame, format, compression_threshold, compression_ratio);    
-   			adjust_volume(frame, format, 1.8f);  
-			}
-		    #pragma omp task
-		    {
-		    apply_equalizer(frame, format, bass_gain, treble_gain);      
-   			adjust_volume(frame, format, volume_gain);
-   			}
-		    #pragma omp task
-		    {
-		    apply_reverb(frame, format, decay_factor, delay_samples);
-			adjust_volume(frame, format, 2.2f);  
-		    }
-		}
-	}
+	apply_bandpass_filter(effects.bandpass, frame, format, low_cutoff, high_cutoff, bandpass_gain);
+	adjust_volume(frame, format, volume_gain);
+	apply_compression(frame, format, compression_threshold, compression_ratio);
+	adjust_volume(frame, format, 1.8f);
+	apply_equalizer(effects.equalizer, frame, format, bass_gain, treble_gain);
+	adjust_volume(frame, format, volume_gain);
+	apply_reverb(effects.reverb, frame, format, decay_factor, room_size);
+	adjust_volume(frame, format, 2.2f);
    
 }
 
 // Decode audio frames
 int decode_audio(AVFormatContext* input_format_ctx, AVCodecContext* decoder_ctx, int audio_stream_index, SwrContext* swr_ctx, AVCodecContext* encoder_ctx, AVStream* out_stream, AVFormatContext* output_format_ctx) {
     AVPacket* input_packet = av_packet_alloc();
+    AVPacket* output_packet = av_packet_alloc(); // Reused for every encoded packet
     AVFrame* input_frame = av_frame_alloc();
     AVFrame* resampled_frame = av_frame_alloc();
     resampled_frame->nb_samples = encoder_ctx->frame_size;
@@ -369,6 +199,7 @@ int decode_audio(AVFormatContext* input_format_ctx, AVCodecContext* decoder_ctx,
     av_frame_get_buffer(resampled_frame, 0);
 
     int64_t pts = 0;
+    StreamEffects effects;
 
     while (av_read_frame(input_format_ctx, input_packet) >= 0) {
         if (input_packet->stream_index == audio_stream_index) {
@@ -378,7 +209,7 @@ int decode_audio(AVFormatContext* input_format_ctx, AVCodecContext* decoder_ctx,
             }
 
             while (avcodec_receive_frame(decoder_ctx, input_frame) == 0) {
-                process_audio_frame(input_frame, decoder_ctx->sample_fmt); // Process frame
+                process_audio_frame(effects, input_frame, decoder_ctx->sample_fmt); // Process frame
 
                 // Resample
                 swr_convert(swr_ctx, resampled_frame->data, resampled_frame->nb_samples,
@@ -392,7 +223,6 @@ int decode_audio(AVFormatContext* input_format_ctx, AVCodecContext* decoder_ctx,
                     return 1;
                 }
 
-                AVPacket* output_packet = av_packet_alloc();
                 while (avcodec_receive_packet(encoder_ctx, output_packet) == 0) {
                     output_packet->stream_index = 0;
                     av_packet_rescale_ts(output_packet, encoder_ctx->time_base, out_stream->time_base);
@@ -401,13 +231,13 @@ int decode_audio(AVFormatContext* input_format_ctx, AVCodecContext* decoder_ctx,
                         return 1;
                     }
                 }
-                av_packet_free(&output_packet);
             }
         }
         av_packet_unref(input_packet);
     }
 
     av_packet_free(&input_packet);
+    av_packet_free(&output_packet);
     av_frame_free(&input_frame);
     av_frame_free(&resampled_frame);
 
@@ -438,6 +268,10 @@ int main(int argc, char* argv[]) {
     const char* input_file = argv[1];
     const char* output_file = argv[2];
 
+    // Pin the effect team once; every frame's parallel region reuses it
+    CpuPlacement placement(affinity_policy_from_env(), kEffectTeamSize);
+    placement.pin_omp_team(kEffectTeamSize);
+
     av_log_set_level(AV_LOG_VERBOSE);
 
     // Initialize input format context
@@ -483,6 +317,10 @@ int main(int argc, char* argv[]) {
     encoder_ctx->sample_rate = decoder_ctx->sample_rate;
     encoder_ctx->ch_layout = decoder_ctx->ch_layout;
     encoder_ctx->bit_rate = 192000;
+    // Encoded payloads come from a recycled buffer pool instead of a fresh
+    // allocation per packet
+    PacketPool packet_pool;
+    packet_pool.attach_encoder(encoder_ctx);
     avcodec_open2(encoder_ctx, encoder, nullptr);
 
     // Initialize output format context
@@ -13,6 +13,7 @@ extern "C" {
     #include <libavutil/channel_layout.h>
     #include <libavutil/samplefmt.h>
 }
+#include "PacketPool.h"
 //equaliser to  enhance clarity, bass, or treble as desired. 
 void apply_equalizer(AVFrame* frame, enum AVSampleFormat format, float bass_gain, float treble_gain) {
     
@@ -337,6 +338,7 @@ void process_audio_frame(AVFrame* frame, enum AVSampleFormat format) {
 // Decode audio frames
 int decode_audio(AVFormatContext* input_format_ctx, AVCodecContext* decoder_ctx, int audio_stream_index, SwrContext* swr_ctx, AVCodecContext* encoder_ctx, AVStream* out_stream, AVFormatContext* output_format_ctx) {
     AVPacket* input_packet = av_packet_alloc();
+    AVPacket* output_packet = av_packet_alloc(); // Reused for every encoded packet
     AVFrame* input_frame = av_frame_alloc();
     AVFrame* resampled_frame = av_frame_alloc();
     resampled_frame->nb_samples = encoder_ctx->frame_size;
@@ -368,7 +370,6 @@ int decode_audio(AVFormatContext* input_format_ctx, AVCodecContext* decoder_ctx,
                     return 1;
                 }
 
-                AVPacket* output_packet = av_packet_alloc();
                 while (avcodec_receive_packet(encoder_ctx, output_packet) == 0) {
                     output_packet->stream_index = 0;
                     av_packet_rescale_ts(output_packet, encoder_ctx->time_base, out_stream->time_base);
@@ -377,13 +378,13 @@ int decode_audio(AVFormatContext* input_format_ctx, AVCodecContext* decoder_ctx,
                         return 1;
                     }
                 }
-                av_packet_free(&output_packet);
             }
         }
         av_packet_unref(input_packet);
     }
 
     av_packet_free(&input_packet);
+    av_packet_free(&output_packet);
     av_frame_free(&input_frame);
     av_frame_free(&resampled_frame);
 
@@ -459,6 +460,10 @@ int main(int argc, char* argv[]) {
     encoder_ctx->sample_rate = decoder_ctx->sample_rate;
     encoder_ctx->ch_layout = decoder_ctx->ch_layout;
     encoder_ctx->bit_rate = 192000;
+    // Encoded payloads come from a recycled buffer pool instead of a fresh
+    // allocation per packet
+    PacketPool packet_pool;
+    packet_pool.attach_encoder(encoder_ctx);
     avcodec_open2(encoder_ctx, encoder, nullptr);
 
     // Initialize output format context
@@ -0,0 +1,110 @@
+#ifndef BATCH_QUEUE_H
+#define BATCH_QUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include "SpscRing.h"
+
+// Up to kMaxItems items handed from one stage to the next in a single queue
+// operation. Passed by value; the items themselves are pointers.
+template <typename T>
+struct Batch {
+    static const int kMaxItems = 64;
+
+    T items[kMaxItems];
+    int count = 0;
+    uint64_t sequence = 0; // Position in the stream of batches, see number_batches()
+    int64_t samples = 0;   // Audio samples carried, 0 for packets
+    size_t bytes = 0;      // Payload carried, what the ring's byte budget sees
+};
+
+// SPSC link between two stages that moves items in batches, so the ring
+// operation and any wake-up of the consumer are paid once per batch instead
+// of once per item.
+//
+// The producer adds items one at a time; a batch is pushed once it holds
+// max_items items or max_samples samples (0: no sample limit), and whatever
+// is left is pushed by close(). The consumer pops whole batches. Depth and
+// byte limits are given in items and bytes like a plain SpscRing; the ring
+// gets enough batch slots for at least max_depth items.
+template <typename T>
+class BatchQueue {
+public:
+    BatchQueue(size_t max_depth, size_t max_bytes, int max_items, int64_t max_samples)
+        : ring_(slots_for(max_depth, max_items), max_bytes), max_items_(max_items), max_samples_(max_samples) {}
+
+    BatchQueue(const BatchQueue&) = delete;
+    BatchQueue& operator=(const BatchQueue&) = delete;
+
+    // Batches pushed from now on are numbered first, first + step, ... When
+    // one producer deals batches round-robin over N queues, queue i numbered
+    // (i, N) gives every batch its position in the producer's stream.
+    void number_batches(uint64_t first, uint64_t step) {
+        next_sequence_ = first;
+        sequence_step_ = step;
+    }
+
+    // Producer side. Blocks while the ring is full and the batch is due.
+    // Returns true if this item completed a batch and it was handed over.
+    bool push(T item, size_t bytes, int64_t samples = 0) {
+        pending_.items[pending_.count++] = item;
+        pending_.bytes += bytes;
+        pending_.samples += samples;
+        if (pending_.count >= max_items_ || (max_samples_ > 0 && pending_.samples >= max_samples_)) {
+            flush();
+            return true;
+        }
+        return false;
+    }
+
+    // Producer side: pass on a batch as it is, sequence number included
+    void push_batch(const Batch<T> &batch) {
+        batches_++;
+        items_ += batch.count;
+        ring_.push(batch, batch.bytes);
+    }
+
+    // Producer side: push the partial batch, then let the consumer finish
+    void close() {
+        flush();
+        ring_.close();
+    }
+
+    // Consumer side. False once the queue is closed and drained.
+    bool pop(Batch<T> &batch) { return ring_.pop(batch); }
+
+    // Producer-side counters; read them once both sides are done
+    uint64_t batches() const { return batches_; }
+    uint64_t items() const { return items_; }
+
+    int max_items() const { return max_items_; }
+    const SpscRing<Batch<T>> &ring() const { return ring_; }
+
+private:
+    static size_t slots_for(size_t max_depth, int max_items) {
+        return (max_depth + max_items - 1) / max_items;
+    }
+
+    void flush() {
+        if (pending_.count == 0) {
+            return;
+        }
+        pending_.sequence = next_sequence_;
+        next_sequence_ += sequence_step_;
+        push_batch(pending_);
+        pending_ = Batch<T>();
+    }
+
+    SpscRing<Batch<T>> ring_;
+    int max_items_;
+    int64_t max_samples_;
+
+    // Producer only
+    Batch<T> pending_;
+    uint64_t batches_ = 0;
+    uint64_t items_ = 0;
+    uint64_t next_sequence_ = 0;
+    uint64_t sequence_step_ = 1;
+};
+
+#endif
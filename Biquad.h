@@ -0,0 +1,319 @@
+#ifndef BIQUAD_H
+#define BIQUAD_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include "SimdKernels.h"
+
+// Second-order IIR sections ("biquads") and a per-stream filter bank that
+// runs a cascade of them over every channel.
+//
+// Coefficients follow the Audio EQ Cookbook (R. Bristow-Johnson), normalized
+// so a0 = 1. Sections run in transposed direct form II, which holds two
+// state values per section and channel. The state lives in the bank and
+// carries over from one frame to the next, so a stream must keep one bank
+// for its whole length (and one per stream, never shared between them).
+//
+// Run sample by sample, a section is a chain of dependent multiply-adds and
+// the vector units sit idle. The bank instead steps each section Span samples
+// at a time (8 with AVX2, 4 with SSE2): the Span outputs are a fixed linear
+// map of the Span inputs and the two state values, namely the lower
+// triangular Toeplitz matrix of the section's impulse response plus its
+// zero-input responses to z1 and z2 (BiquadBlockForm). That is Span + 2
+// vector multiply-adds, and the only serial step left is the state handed to
+// the next block, which TDF-II gives from the block's last two samples. Each
+// channel runs on its own, so mono and stereo gain as much as 5.1. Results
+// agree with the per-sample recursion to float rounding; the scalar level
+// runs that recursion directly.
+
+struct BiquadCoeffs {
+    float b0, b1, b2, a1, a2;
+};
+
+inline BiquadCoeffs biquad_normalize(double b0, double b1, double b2, double a0, double a1, double a2) {
+    return {(float)(b0 / a0), (float)(b1 / a0), (float)(b2 / a0), (float)(a1 / a0), (float)(a2 / a0)};
+}
+
+// Angular frequency, kept just below Nyquist so the design stays stable
+inline double biquad_omega(double sample_rate, double frequency) {
+    return 2.0 * 3.14159265358979323846 * std::min(frequency, 0.49 * sample_rate) / sample_rate;
+}
+
+inline BiquadCoeffs biquad_lowpass(double sample_rate, double frequency, double q) {
+    double w = biquad_omega(sample_rate, frequency), cosw = std::cos(w), alpha = std::sin(w) / (2.0 * q);
+    return biquad_normalize((1.0 - cosw) / 2.0, 1.0 - cosw, (1.0 - cosw) / 2.0,
+                            1.0 + alpha, -2.0 * cosw, 1.0 - alpha);
+}
+
+inline BiquadCoeffs biquad_highpass(double sample_rate, double frequency, double q) {
+    double w = biquad_omega(sample_rate, frequency), cosw = std::cos(w), alpha = std::sin(w) / (2.0 * q);
+    return biquad_normalize((1.0 + cosw) / 2.0, -(1.0 + cosw), (1.0 + cosw) / 2.0,
+                            1.0 + alpha, -2.0 * cosw, 1.0 - alpha);
+}
+
+// Shelves take a linear amplitude gain and use shelf slope 1 (the steepest
+// without overshoot)
+inline BiquadCoeffs biquad_low_shelf(double sample_rate, double frequency, double gain) {
+    double a = std::sqrt(gain), w = biquad_omega(sample_rate, frequency), cosw = std::cos(w);
+    double beta = 2.0 * std::sqrt(a) * (std::sin(w) / 2.0 * std::sqrt(2.0)); // 2 sqrt(A) alpha
+    return biquad_normalize(a * ((a + 1.0) - (a - 1.0) * cosw + beta),
+                            2.0 * a * ((a - 1.0) - (a + 1.0) * cosw),
+                            a * ((a + 1.0) - (a - 1.0) * cosw - beta),
+                            (a + 1.0) + (a - 1.0) * cosw + beta,
+                            -2.0 * ((a - 1.0) + (a + 1.0) * cosw),
+                            (a + 1.0) + (a - 1.0) * cosw - beta);
+}
+
+inline BiquadCoeffs biquad_high_shelf(double sample_rate, double frequency, double gain) {
+    double a = std::sqrt(gain), w = biquad_omega(sample_rate, frequency), cosw = std::cos(w);
+    double beta = 2.0 * std::sqrt(a) * (std::sin(w) / 2.0 * std::sqrt(2.0)); // 2 sqrt(A) alpha
+    return biquad_normalize(a * ((a + 1.0) + (a - 1.0) * cosw + beta),
+                            -2.0 * a * ((a - 1.0) + (a + 1.0) * cosw),
+                            a * ((a + 1.0) + (a - 1.0) * cosw - beta),
+                            (a + 1.0) - (a - 1.0) * cosw + beta,
+                            2.0 * ((a - 1.0) - (a + 1.0) * cosw),
+                            (a + 1.0) - (a - 1.0) * cosw - beta);
+}
+
+// Bell around frequency with the given linear gain at its centre
+inline BiquadCoeffs biquad_peaking(double sample_rate, double frequency, double q, double gain) {
+    double a = std::sqrt(gain), w = biquad_omega(sample_rate, frequency), cosw = std::cos(w);
+    double alpha = std::sin(w) / (2.0 * q);
+    return biquad_normalize(1.0 + alpha * a, -2.0 * cosw, 1.0 - alpha * a,
+                            1.0 + alpha / a, -2.0 * cosw, 1.0 - alpha / a);
+}
+
+// Fourth-order Butterworth band-pass: two high-pass sections at low_cutoff,
+// two low-pass sections at high_cutoff, scaled to passband_gain
+inline std::vector<BiquadCoeffs> design_bandpass(double sample_rate, double low_cutoff, double high_cutoff,
+                                                 double passband_gain = 1.0) {
+    const double q[2] = {0.54119610, 1.30656296}; // Butterworth pole pairs of a 4th-order filter
+    std::vector<BiquadCoeffs> sections = {
+        biquad_highpass(sample_rate, low_cutoff, q[0]), biquad_highpass(sample_rate, low_cutoff, q[1]),
+        biquad_lowpass(sample_rate, high_cutoff, q[0]), biquad_lowpass(sample_rate, high_cutoff, q[1]),
+    };
+    sections[0].b0 *= passband_gain;
+    sections[0].b1 *= passband_gain;
+    sections[0].b2 *= passband_gain;
+    return sections;
+}
+
+// Bass and treble shelves, gains linear
+inline std::vector<BiquadCoeffs> design_equalizer(double sample_rate, double bass_frequency, double bass_gain,
+                                                  double treble_frequency, double treble_gain) {
+    return {biquad_low_shelf(sample_rate, bass_frequency, bass_gain),
+            biquad_high_shelf(sample_rate, treble_frequency, treble_gain)};
+}
+
+// A section's Span outputs as columns[j] * x[j] summed over the inputs, plus
+// from_z1 * z1 + from_z2 * z2 for the state at the start of the block
+template <int Span>
+struct BiquadBlockForm {
+    alignas(32) float columns[Span][Span];
+    alignas(32) float from_z1[Span];
+    alignas(32) float from_z2[Span];
+
+    explicit BiquadBlockForm(const BiquadCoeffs &c) {
+        // Responses over Span samples, worked out in double
+        auto respond = [&](int impulse_at, double z1, double z2, float *out) {
+            for (int i = 0; i < Span; i++) {
+                double x = i == impulse_at ? 1.0 : 0.0;
+                double y = c.b0 * x + z1;
+                z1 = c.b1 * x - c.a1 * y + z2;
+                z2 = c.b2 * x - c.a2 * y;
+                out[i] = (float)y;
+            }
+        };
+        float impulse[Span];
+        respond(0, 0.0, 0.0, impulse);
+        for (int j = 0; j < Span; j++) {
+            for (int i = 0; i < Span; i++) {
+                columns[j][i] = i >= j ? impulse[i - j] : 0.0f;
+            }
+        }
+        respond(-1, 1.0, 0.0, from_z1);
+        respond(-1, 0.0, 1.0, from_z2);
+    }
+};
+
+// The cascade over n samples of one channel, sample by sample from i on
+// (also the vector kernels' tail); z holds z1, z2 per section
+static inline void biquad_cascade_scalar(const BiquadCoeffs *c, size_t sections, float *z, float *x, int i, int n) {
+    for (; i < n; i++) {
+        float v = x[i];
+        for (size_t s = 0; s < sections; s++) {
+            float out = c[s].b0 * v + z[2 * s];
+            z[2 * s] = c[s].b1 * v - c[s].a1 * out + z[2 * s + 1];
+            z[2 * s + 1] = c[s].b2 * v - c[s].a2 * out;
+            v = out;
+        }
+        x[i] = v;
+    }
+}
+
+// The state after a block, from its last two inputs and outputs
+static inline void biquad_block_state(const BiquadCoeffs &c, float *z, float x1, float x0, float y1, float y0) {
+    z[1] = c.b2 * x0 - c.a2 * y0;
+    z[0] = c.b1 * x0 - c.a1 * y0 + c.b2 * x1 - c.a2 * y1;
+}
+
+#ifdef SIMD_KERNELS_X86
+
+// Every section in turn over each 4-sample block, which stays in L1
+// between them
+__attribute__((target("sse2")))
+static void biquad_cascade_sse2(const BiquadCoeffs *c, const BiquadBlockForm<4> *forms, size_t sections,
+                                float *z, float *x, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float *v = x + i;
+        for (size_t s = 0; s < sections; s++) {
+            const BiquadBlockForm<4> &f = forms[s];
+            float x2 = v[2], x3 = v[3];
+            __m128 a = _mm_mul_ps(_mm_load_ps(f.columns[0]), _mm_set1_ps(v[0]));
+            __m128 b = _mm_mul_ps(_mm_load_ps(f.columns[1]), _mm_set1_ps(v[1]));
+            a = _mm_add_ps(a, _mm_mul_ps(_mm_load_ps(f.columns[2]), _mm_set1_ps(x2)));
+            b = _mm_add_ps(b, _mm_mul_ps(_mm_load_ps(f.columns[3]), _mm_set1_ps(x3)));
+            a = _mm_add_ps(a, _mm_mul_ps(_mm_load_ps(f.from_z1), _mm_set1_ps(z[2 * s])));
+            b = _mm_add_ps(b, _mm_mul_ps(_mm_load_ps(f.from_z2), _mm_set1_ps(z[2 * s + 1])));
+            _mm_storeu_ps(v, _mm_add_ps(a, b));
+            biquad_block_state(c[s], &z[2 * s], x2, x3, v[2], v[3]);
+        }
+    }
+    biquad_cascade_scalar(c, sections, z, x, i, n);
+}
+
+__attribute__((target("avx2,fma")))
+static void biquad_cascade_avx2(const BiquadCoeffs *c, const BiquadBlockForm<8> *forms, size_t sections,
+                                float *z, float *x, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        float *v = x + i;
+        for (size_t s = 0; s < sections; s++) {
+            const BiquadBlockForm<8> &f = forms[s];
+            float x6 = v[6], x7 = v[7];
+            // Two accumulators halve the chain of dependent adds
+            __m256 a = _mm256_mul_ps(_mm256_load_ps(f.columns[0]), _mm256_broadcast_ss(v + 0));
+            __m256 b = _mm256_mul_ps(_mm256_load_ps(f.columns[1]), _mm256_broadcast_ss(v + 1));
+            a = _mm256_fmadd_ps(_mm256_load_ps(f.columns[2]), _mm256_broadcast_ss(v + 2), a);
+            b = _mm256_fmadd_ps(_mm256_load_ps(f.columns[3]), _mm256_broadcast_ss(v + 3), b);
+            a = _mm256_fmadd_ps(_mm256_load_ps(f.columns[4]), _mm256_broadcast_ss(v + 4), a);
+            b = _mm256_fmadd_ps(_mm256_load_ps(f.columns[5]), _mm256_broadcast_ss(v + 5), b);
+            a = _mm256_fmadd_ps(_mm256_load_ps(f.columns[6]), _mm256_set1_ps(x6), a);
+            b = _mm256_fmadd_ps(_mm256_load_ps(f.columns[7]), _mm256_set1_ps(x7), b);
+            a = _mm256_fmadd_ps(_mm256_load_ps(f.from_z1), _mm256_set1_ps(z[2 * s]), a);
+            b = _mm256_fmadd_ps(_mm256_load_ps(f.from_z2), _mm256_set1_ps(z[2 * s + 1]), b);
+            _mm256_storeu_ps(v, _mm256_add_ps(a, b));
+            biquad_block_state(c[s], &z[2 * s], x6, x7, v[6], v[7]);
+        }
+    }
+    biquad_cascade_scalar(c, sections, z, x, i, n);
+}
+
+#endif // SIMD_KERNELS_X86
+
+class BiquadBank {
+public:
+    // Samples per channel gathered into one block
+    static constexpr int kBlock = 256;
+
+    BiquadBank() = default;
+
+    // Installs a cascade for the given channel count and clears the state.
+    // The kernel follows simd_best_level(), so PARALLEL_FFMPEG_SIMD caps it
+    // too.
+    void configure(std::vector<BiquadCoeffs> sections, int channels, int sample_rate = 0) {
+        sections_ = std::move(sections);
+        channels_ = channels;
+        sample_rate_ = sample_rate;
+        z_.assign(sections_.size() * 2 * channels, 0.0f);
+        block_.assign((size_t)kBlock * channels, 0.0f);
+        level_ = SimdLevel::scalar;
+        forms4_.clear();
+        forms8_.clear();
+#ifdef SIMD_KERNELS_X86
+        SimdLevel best = simd_best_level();
+        if (best >= SimdLevel::avx2 && __builtin_cpu_supports("fma")) {
+            level_ = SimdLevel::avx2;
+            for (const BiquadCoeffs &c : sections_) {
+                forms8_.emplace_back(c);
+            }
+        } else if (best >= SimdLevel::sse2) {
+            level_ = SimdLevel::sse2;
+            for (const BiquadCoeffs &c : sections_) {
+                forms4_.emplace_back(c);
+            }
+        }
+#endif
+    }
+
+    // True once configured for this stream shape; designs are per sample rate
+    bool configured_for(int sample_rate, int channels) const {
+        return !sections_.empty() && sample_rate_ == sample_rate && channels_ == channels;
+    }
+
+    void reset() {
+        std::fill(z_.begin(), z_.end(), 0.0f);
+    }
+
+    size_t sections() const { return sections_.size(); }
+    int channels() const { return channels_; }
+
+    // Filters a frame through a SampleAccess (see SampleFormat.h) in place,
+    // kBlock samples per channel at a time; the output is clamped to full
+    // scale
+    template <typename Access>
+    void process(Access samples, int nb_samples) {
+        const ptrdiff_t step = samples.step();
+        for (int start = 0; start < nb_samples; start += kBlock) {
+            int n = std::min(kBlock, nb_samples - start);
+            for (int ch = 0; ch < channels_; ch++) {
+                auto *data = samples.channel(ch) + start * step;
+                float *x = &block_[(size_t)ch * kBlock];
+                for (int i = 0; i < n; i++) {
+                    x[i] = Access::read(data[i * step]);
+                }
+                run_cascade(ch, x, n);
+                for (int i = 0; i < n; i++) {
+                    data[i * step] = Access::write(std::clamp(x[i], -1.0f, 1.0f));
+                }
+            }
+        }
+        // A decaying tail ends in denormals, which are very slow on x86;
+        // once the state is that small it is silence anyway
+        for (float &state : z_) {
+            state = std::fabs(state) < 1e-20f ? 0.0f : state;
+        }
+    }
+
+private:
+    void run_cascade(int ch, float *x, int n) {
+        float *z = &z_[(size_t)ch * sections_.size() * 2];
+        switch (level_) {
+#ifdef SIMD_KERNELS_X86
+            case SimdLevel::avx2:
+                biquad_cascade_avx2(sections_.data(), forms8_.data(), sections_.size(), z, x, n);
+                break;
+            case SimdLevel::sse2:
+                biquad_cascade_sse2(sections_.data(), forms4_.data(), sections_.size(), z, x, n);
+                break;
+#endif
+            default:
+                biquad_cascade_scalar(sections_.data(), sections_.size(), z, x, 0, n);
+                break;
+        }
+    }
+
+    std::vector<BiquadCoeffs> sections_;
+    int channels_ = 0;
+    int sample_rate_ = 0;
+    SimdLevel level_ = SimdLevel::scalar;
+    std::vector<BiquadBlockForm<4>> forms4_;  // SSE2 block forms, one per section
+    std::vector<BiquadBlockForm<8>> forms8_;  // AVX2 block forms, one per section
+    std::vector<float> z_;                    // [channel][section][z1, z2]
+    std::vector<float> block_;                // [channel][sample]
+};
+
+#endif
@@ -5,6 +5,19 @@
 #include <omp.h>
 #include <utility> 
 #include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 extern "C" {
     #include <libavformat/avformat.h>
     #include <libavcodec/avcodec.h>
@@ -12,61 +25,578 @@ extern "C" {
     #include <libavutil/opt.h>
     #include <libavutil/channel_layout.h>
 	#include <libavutil/samplefmt.h>
+	#include <libavutil/audio_fifo.h>
 }
+#include "Affinity.h"
 
 
 
 
 void process_decoded_frame(AVFrame *frame);
 
-std::vector<std::pair<int, int>> create_chunks(const std::string &input_file, int chunk_duration) {
+// One audio packet of the input as seen by a single demux pass. The layout is
+// also the on-disk record of the sidecar cache, so keep it fixed size.
+struct PacketIndexEntry {
+    int64_t pos;      // Byte offset of the packet in the input file
+    int64_t pts;      // Presentation timestamp in the stream time base
+    int32_t duration; // Duration in the stream time base
+    int32_t size;     // Packet size in bytes
+};
+
+// Packet index plus what a worker needs to open the input without probing.
+// Entries either live in owned_entries (built this run) or point into a
+// read-only mapping of the sidecar file.
+struct PacketIndex {
+    int stream_index = -1;
+    enum AVCodecID codec_id = AV_CODEC_ID_NONE;
+    AVRational time_base = {0, 1};
+    int sample_rate = 0;
+    int channels = 0;
+    std::string format_name;
+    int64_t start_skip = 0;  // Encoder delay samples the first packet carries
+    int64_t end_discard = 0; // Padding samples at the end of the last packet
+
+    const PacketIndexEntry *entries = nullptr;
+    size_t entry_count = 0;
+
+    std::vector<PacketIndexEntry> owned_entries;
+    void *mapping = nullptr;
+    size_t mapping_size = 0;
+
+    PacketIndex() = default;
+    PacketIndex(const PacketIndex&) = delete;
+    PacketIndex& operator=(const PacketIndex&) = delete;
+    ~PacketIndex() {
+        if (mapping) {
+            munmap(mapping, mapping_size);
+        }
+    }
+};
+
+// Largest main_data_begin backstep an MP3 frame can take into earlier frames
+const int kMp3MaxReservoirBytes = 511;
+
+uint32_t read_le32(const uint8_t *data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+// Read every packet of the audio stream once, without decoding, and record
+// where it lives in the file so chunk workers can seek to exact packets.
+bool build_packet_index(const std::string &input_file, PacketIndex &index) {
     AVFormatContext *fmt_ctx = nullptr;
-    avformat_open_input(&fmt_ctx, input_file.c_str(), nullptr, nullptr);
-    avformat_find_stream_info(fmt_ctx, nullptr);
+    if (avformat_open_input(&fmt_ctx, input_file.c_str(), nullptr, nullptr) < 0) {
+        std::cerr << "Could not open input file '" << input_file << "'" << std::endl;
+        return false;
+    }
 
-    // Get the total duration in seconds
-    int64_t total_duration = fmt_ctx->duration / AV_TIME_BASE; // in seconds
-    int num_chunks = (total_duration + chunk_duration - 1) / chunk_duration; // Calculate number of chunks
-    std::vector<std::pair<int, int>> chunks(num_chunks);
+    if (avformat_find_stream_info(fmt_ctx, nullptr) < 0) {
+        std::cerr << "Could not find stream information" << std::endl;
+        avformat_close_input(&fmt_ctx);
+        return false;
+    }
 
-    #pragma omp parallel for
-    for (int i = 0; i < num_chunks; ++i) {
-        int start_time = i * chunk_duration;
-        int end_time = std::min(start_time + chunk_duration, (int)total_duration);
-        chunks[i] = {start_time, end_time};
+    index.stream_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+    if (index.stream_index < 0) {
+        std::cerr << "Could not find audio stream in input file" << std::endl;
+        avformat_close_input(&fmt_ctx);
+        return false;
     }
 
+    AVStream *audio_stream = fmt_ctx->streams[index.stream_index];
+    index.codec_id = audio_stream->codecpar->codec_id;
+    index.time_base = audio_stream->time_base;
+    index.sample_rate = audio_stream->codecpar->sample_rate;
+    index.channels = audio_stream->codecpar->ch_layout.nb_channels;
+    index.format_name = fmt_ctx->iformat->name;
+    index.start_skip = 0;
+    index.end_discard = 0;
+    index.owned_entries.clear();
+
+    AVPacket *packet = av_packet_alloc();
+    bool usable = true;
+    while (av_read_frame(fmt_ctx, packet) >= 0) {
+        if (packet->stream_index == index.stream_index) {
+            if (packet->pos < 0 || packet->pts == AV_NOPTS_VALUE) {
+                usable = false;
+            }
+            index.owned_entries.push_back({packet->pos, packet->pts, (int32_t)packet->duration, packet->size});
+
+            // Gapless info (LAME/iTunes tags) arrives as skip samples side data
+            size_t side_size = 0;
+            const uint8_t *skip = av_packet_get_side_data(packet, AV_PKT_DATA_SKIP_SAMPLES, &side_size);
+            if (skip && side_size >= 8) {
+                index.start_skip += read_le32(skip);
+                index.end_discard = read_le32(skip + 4);
+            }
+        }
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
     avformat_close_input(&fmt_ctx);
+
+    if (!usable) {
+        std::cerr << "Input does not expose byte offsets and timestamps for every packet" << std::endl;
+        return false;
+    }
+    index.entries = index.owned_entries.data();
+    index.entry_count = index.owned_entries.size();
+    return index.entry_count > 0;
+}
+
+// Sidecar cache of the packet index, stored next to the input as
+// "<input>.seekidx": this header followed by entry_count PacketIndexEntry
+// records. It is only trusted when size, mtime and content hash of the input
+// still match.
+struct SeekIndexHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t stream_index;
+    int32_t codec_id;
+    int32_t time_base_num;
+    int32_t time_base_den;
+    int32_t sample_rate;
+    int32_t channels;
+    int32_t reserved;
+    char format_name[32];
+    uint64_t file_size;
+    int64_t mtime_ns;
+    uint64_t content_hash;
+    uint64_t entry_count;
+    int64_t start_skip;
+    int64_t end_discard;
+};
+static_assert(sizeof(SeekIndexHeader) % alignof(PacketIndexEntry) == 0, "entries must stay aligned after the header");
+
+const char kSeekIndexMagic[8] = {'P', 'F', 'S', 'E', 'E', 'K', 'I', 'X'};
+const uint32_t kSeekIndexVersion = 2;
+// Bytes hashed from each end of the input to detect in-place rewrites
+const size_t kSeekIndexHashSpan = 64 * 1024;
+
+std::string seek_index_path(const std::string &input_file) {
+    return input_file + ".seekidx";
+}
+
+// Identity of the input: size, mtime and an FNV-1a hash of its head and tail
+bool input_file_key(const std::string &input_file, uint64_t &file_size, int64_t &mtime_ns, uint64_t &content_hash) {
+    int fd = open(input_file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+    file_size = st.st_size;
+    mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+    std::vector<uint8_t> buffer(kSeekIndexHashSpan);
+    uint64_t hash = 1469598103934665603ULL;
+    off_t offsets[2] = {0, (off_t)std::max<uint64_t>(file_size, kSeekIndexHashSpan) - (off_t)kSeekIndexHashSpan};
+    for (off_t offset : offsets) {
+        ssize_t n = pread(fd, buffer.data(), buffer.size(), offset);
+        for (ssize_t i = 0; i < n; ++i) {
+            hash = (hash ^ buffer[i]) * 1099511628211ULL;
+        }
+    }
+    close(fd);
+
+    content_hash = hash;
+    return true;
+}
+
+// Map a matching sidecar read-only; entries are used in place
+bool load_seek_index(const std::string &input_file, PacketIndex &index) {
+    uint64_t file_size;
+    int64_t mtime_ns;
+    uint64_t content_hash;
+    if (!input_file_key(input_file, file_size, mtime_ns, content_hash)) {
+        return false;
+    }
+
+    int fd = open(seek_index_path(input_file).c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SeekIndexHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t mapping_size = st.st_size;
+    void *mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    const SeekIndexHeader *header = (const SeekIndexHeader*)mapping;
+    bool valid = memcmp(header->magic, kSeekIndexMagic, sizeof(kSeekIndexMagic)) == 0 &&
+                 header->version == kSeekIndexVersion &&
+                 header->file_size == file_size &&
+                 header->mtime_ns == mtime_ns &&
+                 header->content_hash == content_hash &&
+                 header->entry_count > 0 &&
+                 header->format_name[sizeof(header->format_name) - 1] == '\0' &&
+                 mapping_size == sizeof(SeekIndexHeader) + header->entry_count * sizeof(PacketIndexEntry);
+    if (!valid) {
+        munmap(mapping, mapping_size);
+        return false;
+    }
+
+    index.stream_index = header->stream_index;
+    index.codec_id = (enum AVCodecID)header->codec_id;
+    index.time_base = {header->time_base_num, header->time_base_den};
+    index.sample_rate = header->sample_rate;
+    index.channels = header->channels;
+    index.format_name = header->format_name;
+    index.start_skip = header->start_skip;
+    index.end_discard = header->end_discard;
+    index.entries = (const PacketIndexEntry*)((const char*)mapping + sizeof(SeekIndexHeader));
+    index.entry_count = header->entry_count;
+    index.mapping = mapping;
+    index.mapping_size = mapping_size;
+    return true;
+}
+
+// Write the sidecar through a temporary file so readers never see half of it
+void save_seek_index(const std::string &input_file, const PacketIndex &index) {
+    SeekIndexHeader header = {};
+    if (!input_file_key(input_file, header.file_size, header.mtime_ns, header.content_hash) ||
+        index.format_name.size() >= sizeof(header.format_name)) {
+        return;
+    }
+    memcpy(header.magic, kSeekIndexMagic, sizeof(kSeekIndexMagic));
+    header.version = kSeekIndexVersion;
+    header.stream_index = index.stream_index;
+    header.codec_id = index.codec_id;
+    header.time_base_num = index.time_base.num;
+    header.time_base_den = index.time_base.den;
+    header.sample_rate = index.sample_rate;
+    header.channels = index.channels;
+    memcpy(header.format_name, index.format_name.c_str(), index.format_name.size() + 1);
+    header.entry_count = index.entry_count;
+    header.start_skip = index.start_skip;
+    header.end_discard = index.end_discard;
+
+    std::string path = seek_index_path(input_file);
+    std::string tmp_path = path + ".tmp";
+    std::ofstream output(tmp_path, std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    output.write(reinterpret_cast<const char*>(index.entries), index.entry_count * sizeof(PacketIndexEntry));
+    output.close();
+    if (!output || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Could not write seek index '" << path << "'" << std::endl;
+        std::remove(tmp_path.c_str());
+    }
+}
+
+// Use the sidecar when it matches the input, otherwise index and cache it
+bool load_or_build_packet_index(const std::string &input_file, PacketIndex &index) {
+    if (load_seek_index(input_file, index)) {
+        return true;
+    }
+    if (!build_packet_index(input_file, index)) {
+        return false;
+    }
+    save_seek_index(input_file, index);
+    return true;
+}
+
+// Output sample positions count from the first sample left after the input's
+// encoder delay (start_skip) is dropped.
+int64_t packet_output_sample(const PacketIndex &index, size_t packet) {
+    return av_rescale_q(index.entries[packet].pts - index.entries[0].pts, index.time_base, {1, index.sample_rate}) - index.start_skip;
+}
+
+int64_t index_total_samples(const PacketIndex &index) {
+    const PacketIndexEntry &last = index.entries[index.entry_count - 1];
+    int64_t last_duration = last.duration;
+    if (last_duration <= 0 && index.entry_count > 1) {
+        last_duration = last.pts - index.entries[index.entry_count - 2].pts;
+    }
+    int64_t end = packet_output_sample(index, index.entry_count - 1) +
+                  av_rescale_q(last_duration, index.time_base, {1, index.sample_rate});
+    return std::max<int64_t>(end - index.end_discard, 0);
+}
+
+// First packet whose decoded samples reach past output sample position
+size_t packet_at_sample(const PacketIndex &index, int64_t position) {
+    int64_t pts = index.entries[0].pts + av_rescale_q(position + index.start_skip, {1, index.sample_rate}, index.time_base);
+    const PacketIndexEntry *end = index.entries + index.entry_count;
+    const PacketIndexEntry *it = std::upper_bound(index.entries, end, pts, [](int64_t value, const PacketIndexEntry &entry) {
+        return value < entry.pts;
+    });
+    return it == index.entries ? 0 : (it - index.entries) - 1;
+}
+
+// Output samples [out_start, out_end) belong to the chunk. Its worker decodes
+// [feed_start, feed_end), which adds encoder warm-up on both sides in parallel
+// encode mode, reading packets [preroll_packet, end_packet). Packets from
+// preroll_packet up to first_packet only prime the decoder's overlap and bit
+// reservoir.
+struct Chunk {
+    int64_t out_start;
+    int64_t out_end;
+    int64_t feed_start;
+    int64_t feed_end;
+    size_t preroll_packet;
+    size_t first_packet;
+    size_t end_packet;
+};
+
+size_t preroll_start(const PacketIndex &index, size_t first_packet) {
+    if (first_packet == 0) {
+        return 0;
+    }
+
+    // One packet for the transform overlap of the first kept frame
+    size_t start = first_packet - 1;
+    if (index.codec_id != AV_CODEC_ID_MP3) {
+        return start;
+    }
+
+    // Plus enough earlier bytes that the overlap packet's reservoir is present
+    int reservoir = 0;
+    while (start > 0 && reservoir < kMp3MaxReservoirBytes) {
+        --start;
+        reservoir += index.entries[start].size;
+    }
+    return start;
+}
+
+// Fixed work every chunk pays before it produces output (opening a demuxer,
+// decoder and encoder, seeking), in seconds of audio decoded and encoded
+const double kChunkOpenCostSeconds = 0.25;
+// Chunks per worker the planner aims for, so a slow chunk near the end of the
+// run does not leave the other workers idle
+const int kChunksPerWorker = 4;
+// Upper bound on work spent on chunk boundaries relative to the whole file
+const double kMaxChunkOverhead = 0.02;
+
+// How the output is cut into chunks, reported with the run stats
+struct ChunkPlan {
+    bool automatic = true;
+    int workers = 0;
+    int64_t total_samples = 0;
+    int64_t chunk_samples = 0;
+    size_t chunk_count = 0;
+    int64_t overhead_samples = 0; // Per chunk: pre/postroll, reservoir preroll and open cost
+    double overhead_fraction = 0.0;
+    int64_t memory_budget = 0;    // Bytes of chunk data allowed in flight, 0 for no limit
+    int64_t chunk_bytes = 0;      // Estimated bytes one in-flight chunk holds
+    size_t window = 0;            // Chunks allowed in flight at once
+};
+
+// Samples decoded ahead of a chunk only to refill the MP3 bit reservoir, see
+// preroll_start()
+int64_t reservoir_preroll_samples(const PacketIndex &index) {
+    if (index.codec_id != AV_CODEC_ID_MP3 || index.entry_count < 2) {
+        return 0;
+    }
+    const PacketIndexEntry &first = index.entries[0];
+    const PacketIndexEntry &last = index.entries[index.entry_count - 1];
+    int64_t packet_bytes = std::max<int64_t>((last.pos - first.pos) / (int64_t)(index.entry_count - 1), 1);
+    int64_t packets = (kMp3MaxReservoirBytes + packet_bytes - 1) / packet_bytes + 1;
+    return packets * av_rescale_q(first.duration, index.time_base, {1, index.sample_rate});
+}
+
+// Pick the chunk length. A requested length (chunk_seconds > 0) is used as is.
+// Otherwise aim for kChunksPerWorker chunks per worker, but never let the
+// per-chunk overhead exceed kMaxChunkOverhead of a chunk unless that would
+// leave workers without a chunk. Either way a chunk is capped so that one per
+// worker fits the memory budget, given the bytes an in-flight chunk holds per
+// output sample. Lengths are multiples of frame_size.
+ChunkPlan plan_chunks(const PacketIndex &index, int workers, double chunk_seconds, int frame_size,
+                      int64_t preroll, int64_t postroll, double bytes_per_sample, int64_t memory_budget) {
+    ChunkPlan plan;
+    plan.memory_budget = memory_budget;
+    plan.automatic = chunk_seconds <= 0;
+    plan.workers = std::max(workers, 1);
+    plan.total_samples = index_total_samples(index);
+    plan.overhead_samples = preroll + postroll + reservoir_preroll_samples(index) +
+                            (int64_t)(kChunkOpenCostSeconds * index.sample_rate);
+
+    int64_t chunk_samples;
+    if (!plan.automatic) {
+        chunk_samples = (int64_t)(chunk_seconds * index.sample_rate);
+    } else {
+        int64_t balanced = plan.total_samples / ((int64_t)plan.workers * kChunksPerWorker);
+        int64_t amortized = (int64_t)(plan.overhead_samples / kMaxChunkOverhead);
+        int64_t per_worker = (plan.total_samples + plan.workers - 1) / plan.workers;
+        chunk_samples = std::max(balanced, std::min(amortized, per_worker));
+    }
+    if (bytes_per_sample > 0 && memory_budget > 0) {
+        chunk_samples = std::min(chunk_samples, (int64_t)(memory_budget / plan.workers / bytes_per_sample));
+    }
+    plan.chunk_samples = std::max<int64_t>((chunk_samples + frame_size / 2) / frame_size, 1) * frame_size;
+    plan.chunk_count = (size_t)((plan.total_samples + plan.chunk_samples - 1) / plan.chunk_samples);
+    if (plan.total_samples > 0) {
+        plan.overhead_fraction = (double)(plan.overhead_samples * (int64_t)plan.chunk_count) / plan.total_samples;
+    }
+    plan.chunk_bytes = std::max<int64_t>((int64_t)((plan.chunk_samples + preroll + postroll) * bytes_per_sample), 1);
+    plan.window = memory_budget > 0 ? (size_t)std::max<int64_t>(memory_budget / plan.chunk_bytes, 1) : plan.chunk_count;
+    return plan;
+}
+
+void print_chunk_plan(const ChunkPlan &plan, int sample_rate) {
+    std::cout << "Chunk plan: " << plan.chunk_count << " chunks of "
+              << (double)plan.chunk_samples / sample_rate << " s"
+              << (plan.automatic ? " (auto)" : " (requested)") << " for "
+              << plan.workers << " workers over " << (double)plan.total_samples / sample_rate << " s, "
+              << "boundary overhead " << plan.overhead_fraction * 100.0 << "%, "
+              << plan.window << " chunks of ~" << plan.chunk_bytes / 1024 << " KiB in flight (budget "
+              << plan.memory_budget / (1024 * 1024) << " MiB)" << std::endl;
+}
+
+// Split the output into chunks of plan.chunk_samples. Boundaries sit on
+// multiples of the encoder frame size so per-chunk encoders share one packet
+// grid; preroll/postroll samples of real audio around each chunk let a fresh
+// encoder settle before its first kept packet and after its last.
+std::vector<Chunk> create_chunks(const PacketIndex &index, const ChunkPlan &plan, int64_t preroll, int64_t postroll) {
+    std::vector<Chunk> chunks;
+    int64_t total = plan.total_samples;
+
+    for (int64_t start = 0; start < total; start += plan.chunk_samples) {
+        Chunk chunk;
+        chunk.out_start = start;
+        chunk.out_end = std::min(start + plan.chunk_samples, total);
+        chunk.feed_start = std::max<int64_t>(chunk.out_start - preroll, 0);
+        chunk.feed_end = std::min(chunk.out_end + postroll, total);
+        chunk.first_packet = packet_at_sample(index, chunk.feed_start);
+        chunk.end_packet = chunk.feed_end == total ? index.entry_count : packet_at_sample(index, chunk.feed_end - 1) + 1;
+        chunk.preroll_packet = preroll_start(index, chunk.first_packet);
+        chunks.push_back(chunk);
+    }
     return chunks;
 }
 
 
-std::vector<std::pair<AVFrame*, int64_t>> decode_audio_chunk(AVCodecContext *dec_ctx, int stream_index, AVFormatContext *fmt_ctx, AVStream *audio_stream, int start_time, int end_time) {
-    std::vector<std::pair<AVFrame*, int64_t>> decoded_frames;
+// Demuxer and decoder owned by a single chunk worker. Every OpenMP thread opens
+// its own so seeks, read positions and decoder state are never shared.
+struct DecoderWorker {
+    AVFormatContext *fmt_ctx = nullptr;
+    AVCodecContext *dec_ctx = nullptr;
+    AVStream *audio_stream = nullptr;
+    int stream_index = -1;
+};
+
+void close_decoder_worker(DecoderWorker &worker) {
+    avcodec_free_context(&worker.dec_ctx);
+    avformat_close_input(&worker.fmt_ctx);
+    worker.audio_stream = nullptr;
+    worker.stream_index = -1;
+}
+
+// The packet index already knows the container, stream and codec, so workers
+// skip format probing and avformat_find_stream_info() entirely.
+bool open_decoder_worker(const std::string &input_file, const PacketIndex &index, DecoderWorker &worker) {
+    const AVInputFormat *input_format = av_find_input_format(index.format_name.c_str());
+    if (avformat_open_input(&worker.fmt_ctx, input_file.c_str(), input_format, nullptr) < 0) {
+        std::cerr << "Could not open input file '" << input_file << "'" << std::endl;
+        return false;
+    }
+
+    if (index.stream_index >= (int)worker.fmt_ctx->nb_streams) {
+        std::cerr << "Could not find audio stream in input file" << std::endl;
+        close_decoder_worker(worker);
+        return false;
+    }
+    worker.stream_index = index.stream_index;
+    worker.audio_stream = worker.fmt_ctx->streams[worker.stream_index];
+
+    const AVCodec *decoder = avcodec_find_decoder(index.codec_id);
+    if (!decoder) {
+        std::cerr << "Failed to find decoder for stream" << std::endl;
+        close_decoder_worker(worker);
+        return false;
+    }
+
+    worker.dec_ctx = avcodec_alloc_context3(decoder);
+    if (!worker.dec_ctx) {
+        std::cerr << "Could not allocate decoder context" << std::endl;
+        close_decoder_worker(worker);
+        return false;
+    }
+
+    if (avcodec_parameters_to_context(worker.dec_ctx, worker.audio_stream->codecpar) < 0) {
+        std::cerr << "Could not copy codec parameters to decoder context" << std::endl;
+        close_decoder_worker(worker);
+        return false;
+    }
+
+    // Fill in what stream info probing would have found
+    if (worker.dec_ctx->sample_rate <= 0) {
+        worker.dec_ctx->sample_rate = index.sample_rate;
+    }
+    if (worker.dec_ctx->ch_layout.nb_channels <= 0 && index.channels > 0) {
+        av_channel_layout_uninit(&worker.dec_ctx->ch_layout);
+        av_channel_layout_default(&worker.dec_ctx->ch_layout, index.channels);
+    }
+    worker.dec_ctx->pkt_timebase = index.time_base;
+
+    // Start/end trimming is done against the index, not by the decoder, since
+    // whether skip side data shows up after a byte seek depends on the demuxer
+    worker.dec_ctx->flags2 |= AV_CODEC_FLAG2_SKIP_MANUAL;
+
+    // Parallelism comes from the chunk workers, keep each decoder single threaded
+    worker.dec_ctx->thread_count = 1;
+
+    if (avcodec_open2(worker.dec_ctx, decoder, nullptr) < 0) {
+        std::cerr << "Could not open decoder" << std::endl;
+        close_decoder_worker(worker);
+        return false;
+    }
+
+    return true;
+}
+
+
+// Decode the chunk's packets and pass every frame overlapping its feed range
+// to on_frame(), which takes ownership, keyed by output sample position. Frames
+// are handed on as soon as they are decoded, so a chunk never holds more than
+// on_frame() keeps. Returns false if seeking fails or on_frame() does.
+bool decode_audio_chunk(DecoderWorker &worker, const PacketIndex &index, const Chunk &chunk,
+                        const std::function<bool(AVFrame*, int64_t)> &on_frame) {
+    AVFormatContext *fmt_ctx = worker.fmt_ctx;
+    AVCodecContext *dec_ctx = worker.dec_ctx;
+    int stream_index = worker.stream_index;
+
     AVPacket *packet = av_packet_alloc();
 
-    // Seek to the start time
-    int64_t seek_target = av_rescale_q(start_time * AV_TIME_BASE, AV_TIME_BASE_Q, audio_stream->time_base);
-    if (av_seek_frame(fmt_ctx, stream_index, seek_target, AVSEEK_FLAG_BACKWARD) < 0) {
-        std::cerr << "Error seeking to start time" << std::endl;
+    // Seek straight to the first packet we need
+    const PacketIndexEntry &seek_entry = index.entries[chunk.preroll_packet];
+    if (av_seek_frame(fmt_ctx, stream_index, seek_entry.pos, AVSEEK_FLAG_BYTE) < 0) {
+        std::cerr << "Error seeking to chunk start" << std::endl;
         av_packet_free(&packet);
-        return decoded_frames;
+        return false;
     }
 
     // Flush the decoder
     avcodec_flush_buffers(dec_ctx);
 
-    while (av_read_frame(fmt_ctx, packet) >= 0) {
+    bool ok = true;
+    size_t next = chunk.preroll_packet;
+    while (ok && next < chunk.end_packet && av_read_frame(fmt_ctx, packet) >= 0) {
         if (packet->stream_index != stream_index) {
             av_packet_unref(packet);
             continue;
         }
 
-        int64_t pts_time = av_rescale_q(packet->pts, audio_stream->time_base, AV_TIME_BASE_Q) / AV_TIME_BASE;
-        if (pts_time > end_time) {
+        // Match the packet to its index entry by byte offset; timestamps are
+        // not reliable right after a byte seek
+        while (next < chunk.end_packet && index.entries[next].pos < packet->pos) {
+            ++next;
+        }
+        if (next == chunk.end_packet || index.entries[next].pos != packet->pos) {
             av_packet_unref(packet);
-            break;
+            continue;
         }
+        packet->pts = index.entries[next].pts;
+        packet->dts = index.entries[next].pts;
+        packet->duration = index.entries[next].duration;
+        ++next;
 
         int ret = avcodec_send_packet(dec_ctx, packet);
         if (ret < 0) {
@@ -75,7 +605,7 @@ std::vector<std::pair<AVFrame*, int64_t>> decode_audio_chunk(AVCodecContext *dec
             continue;
         }
 
-        while (ret >= 0) {
+        while (ok && ret >= 0) {
             AVFrame *frame = av_frame_alloc();
             ret = avcodec_receive_frame(dec_ctx, frame);
             if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
@@ -87,9 +617,11 @@ std::vector<std::pair<AVFrame*, int64_t>> decode_audio_chunk(AVCodecContext *dec
                 break;
             }
 
-            int64_t frame_pts = av_rescale_q(frame->pts, audio_stream->time_base, AV_TIME_BASE_Q) / AV_TIME_BASE;
-            if (frame_pts >= start_time && frame_pts <= end_time) {
-                decoded_frames.emplace_back(frame, frame_pts);
+            // Hand on frames overlapping the chunk's feed range; preroll
+            // frames only warm the decoder up
+            int64_t position = av_rescale_q(frame->pts - index.entries[0].pts, index.time_base, {1, index.sample_rate}) - index.start_skip;
+            if (position < chunk.feed_end && position + frame->nb_samples > chunk.feed_start) {
+                ok = on_frame(frame, position);
             } else {
                 av_frame_free(&frame);
             }
@@ -99,61 +631,111 @@ std::vector<std::pair<AVFrame*, int64_t>> decode_audio_chunk(AVCodecContext *dec
     }
 
     av_packet_free(&packet);
-    return decoded_frames;
+    return ok;
 }
 
 
 
 
 
-std::vector<std::pair<AVFrame*, int64_t>> decode_data(const std::string &input_file, int chunk_duration) {
-    // Initialize FFmpeg
-    //av_register_all();
+void free_frames(std::vector<std::pair<AVFrame*, int64_t>> &frames) {
+    for (auto& frame_pair : frames) {
+        av_frame_free(&(frame_pair.first));
+    }
+    frames.clear();
+}
 
-    // Open the input file and find stream info
-    AVFormatContext *fmt_ctx = nullptr;
-    avformat_open_input(&fmt_ctx, input_file.c_str(), nullptr, nullptr);
-    avformat_find_stream_info(fmt_ctx, nullptr);
-
-    // Get the best audio stream
-    int stream_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
-    AVStream *audio_stream = fmt_ctx->streams[stream_index];
-    enum AVCodecID codec_id = audio_stream->codecpar->codec_id;
-
-    // Initialize the decoder
-    const AVCodec *decoder = avcodec_find_decoder(codec_id);
-    AVCodecContext *dec_ctx = avcodec_alloc_context3(decoder);
-    avcodec_parameters_to_context(dec_ctx, audio_stream->codecpar);
-    avcodec_open2(dec_ctx, decoder, nullptr);
-
-    // Create chunks
-    auto chunks = create_chunks(input_file, chunk_duration);
-    
-    std::vector<std::pair<AVFrame*, int64_t>> all_decoded_frames;
-
-    #pragma omp parallel for schedule(dynamic)
-    for (size_t i = 0; i < chunks.size(); ++i) {
-        int start_time = chunks[i].first;
-        int end_time = chunks[i].second;
-        auto decoded_chunk = decode_audio_chunk(dec_ctx,stream_index,fmt_ctx, audio_stream, start_time, end_time);
-        
-        #pragma omp critical
+void free_packets(std::vector<AVPacket*> &packets) {
+    for (auto& packet : packets) {
+        av_packet_free(&packet);
+    }
+    packets.clear();
+}
+
+// What a worker hands on for one chunk: processed frames keyed by output
+// sample position (serial encode mode) or the chunk's finished packets
+// (parallel encode mode).
+struct ChunkOutput {
+    std::vector<std::pair<AVFrame*, int64_t>> frames;
+    std::vector<AVPacket*> packets;
+
+    void clear() {
+        free_frames(frames);
+        free_packets(packets);
+    }
+};
+
+// Chunks finish in any order. Each one parks here until all earlier chunks
+// have been handed to the consumer, which therefore sees output in file order
+// as soon as it is available instead of after a global sort.
+struct ChunkReorderBuffer {
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<ChunkOutput> slots;
+    std::vector<bool> ready;
+    size_t next = 0;
+    size_t window;  // Chunks allowed in flight (being worked on or waiting here)
+    bool aborted = false;
+
+    ChunkReorderBuffer(size_t chunk_count, size_t window_chunks)
+        : slots(chunk_count), ready(chunk_count, false), window(std::max<size_t>(window_chunks, 1)) {}
+
+    ~ChunkReorderBuffer() {
+        for (auto& slot : slots) {
+            slot.clear();
+        }
+    }
+
+    void push(size_t chunk, ChunkOutput &output) {
         {
-            all_decoded_frames.insert(all_decoded_frames.end(), decoded_chunk.begin(), decoded_chunk.end());
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!aborted) {
+                std::swap(slots[chunk], output);
+                ready[chunk] = true;
+            }
         }
+        output.clear(); // Only non-empty if nobody will consume an aborted run
+        cv.notify_all();
     }
 
-    // Sort frames by their timestamps
-    std::sort(all_decoded_frames.begin(), all_decoded_frames.end(), [](const auto& a,const auto& b) {
-        return a.second < b.second; // Sort by timestamp
-    });
+    // Blocks a worker until the chunk fits in the in-flight window, which is
+    // what bounds memory when the consumer falls behind. Chunks are claimed in
+    // order, so the chunk the consumer waits for is always already claimed.
+    // Returns false if the run was aborted.
+    bool wait_for_turn(size_t chunk) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [this, chunk] { return aborted || chunk < next + window; });
+        return !aborted;
+    }
 
+    // Blocks until the next chunk in file order is complete. Returns false
+    // once every chunk has been handed out or the run was aborted.
+    bool pop_next(ChunkOutput &output) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [this] { return aborted || next == slots.size() || ready[next]; });
+        if (aborted || next == slots.size()) {
+            return false;
+        }
+        std::swap(output, slots[next]);
+        ++next;
+        lock.unlock();
+        cv.notify_all();
+        return true;
+    }
 
-    // Clean up
-    avcodec_free_context(&dec_ctx);
-    avformat_close_input(&fmt_ctx);
-    return all_decoded_frames;
-}
+    void abort() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            aborted = true;
+        }
+        cv.notify_all();
+    }
+
+    bool is_aborted() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return aborted;
+    }
+};
 
 void adjust_volume(AVFrame* frame, float volume_multiplier) {
     int data_size = av_get_bytes_per_sample((AVSampleFormat)frame->format);
@@ -188,118 +770,597 @@ void process_decoded_frame(AVFrame* frame){
 
 
 
-void encode_audio_chunks(const std::vector<std::pair<AVFrame*, int64_t>>& frames, const std::string& output_file) {
+// Settings shared by every encoder instance of a run, so chunk encoders are
+// interchangeable and their packets concatenate.
+struct EncoderConfig {
+    enum AVSampleFormat sample_fmt = AV_SAMPLE_FMT_NONE;
+    int sample_rate = 0;
+    AVChannelLayout ch_layout = {};
+    int64_t bit_rate = 192000; // Set bit rate (adjust as needed)
+    bool chunked = false;      // Parallel encode mode, see open_frame_encoder()
+    int frame_size = 0;        // Filled in from a probe encoder
+    int initial_padding = 0;
+    int64_t total_samples = 0; // Output length, filled in from the index
+};
+
+// Encoder fed with samples in order. Frames are re-cut to the encoder's frame
+// size through a FIFO since decoded frames rarely line up with chunk edges or
+// the short first and last frames of a file.
+struct FrameEncoder {
+    AVCodecContext *enc_ctx = nullptr;
+    AVAudioFifo *fifo = nullptr;
+    AVFrame *staging = nullptr;
+    int64_t next_pts = 0;
+};
+
+void close_frame_encoder(FrameEncoder &encoder) {
+    av_frame_free(&encoder.staging);
+    if (encoder.fifo) {
+        av_audio_fifo_free(encoder.fifo);
+        encoder.fifo = nullptr;
+    }
+    avcodec_free_context(&encoder.enc_ctx);
+}
+
+// first_pts is the output sample position of the first sample fed in
+bool open_frame_encoder(FrameEncoder &encoder, const EncoderConfig &config, int64_t first_pts) {
     // Initialize FFmpeg encoder
-    const AVCodec *encoder = avcodec_find_encoder(AV_CODEC_ID_MP3);
-    if (!encoder) {
-        // Handle error: encoder not found
-        return;
+    const AVCodec *encoder_codec = avcodec_find_encoder(AV_CODEC_ID_MP3);
+    if (!encoder_codec) {
+        std::cerr << "MP3 encoder not found" << std::endl;
+        return false;
     }
 
-    AVCodecContext *enc_ctx = avcodec_alloc_context3(encoder);
-    if (!enc_ctx) {
-        // Handle error: context allocation failed
-        return;
+    encoder.enc_ctx = avcodec_alloc_context3(encoder_codec);
+    if (!encoder.enc_ctx) {
+        std::cerr << "Could not allocate encoder context" << std::endl;
+        return false;
     }
 
-    // Set encoder parameters
-    
-	AVChannelLayout ch_layout;
-	// Set channel layout to stereo
-	av_channel_layout_default(&ch_layout, 2);    
-    
-    enc_ctx->sample_rate = frames[0].first->sample_rate;  // Use sample rate from the first frame
-    enc_ctx->ch_layout =  ch_layout;  // Use channel layout from the first frame
-    //enc_ctx->ch_layout = enc_ctx->ch_layout.nb_channels;
-    enc_ctx->bit_rate = 192000; // Set bit rate (adjust as needed)
-    enc_ctx->time_base = {1, enc_ctx->sample_rate}; // Time base for audio
+    encoder.enc_ctx->sample_fmt = config.sample_fmt;
+    encoder.enc_ctx->sample_rate = config.sample_rate;
+    av_channel_layout_copy(&encoder.enc_ctx->ch_layout, &config.ch_layout);
+    encoder.enc_ctx->bit_rate = config.bit_rate;
+    encoder.enc_ctx->time_base = {1, config.sample_rate}; // Time base for audio
 
-    // Set the codec's sample format
-    enc_ctx->sample_fmt = encoder->sample_fmts[0]; // Use the first supported sample format
+    // Chunk outputs are spliced packet by packet. A frame may borrow bits from
+    // the frames before it (bit reservoir), which after a splice would belong
+    // to another encoder, so chunk encoders keep every frame self-contained.
+    if (config.chunked && av_opt_set_int(encoder.enc_ctx, "reservoir", 0, AV_OPT_SEARCH_CHILDREN) < 0) {
+        std::cerr << "Encoder cannot disable its bit reservoir" << std::endl;
+        close_frame_encoder(encoder);
+        return false;
+    }
 
     // Open the encoder
-    if (avcodec_open2(enc_ctx, encoder, nullptr) < 0) {
-        // Handle error: could not open encoder
-        avcodec_free_context(&enc_ctx);
-        return;
+    if (avcodec_open2(encoder.enc_ctx, encoder_codec, nullptr) < 0) {
+        std::cerr << "Could not open encoder" << std::endl;
+        close_frame_encoder(encoder);
+        return false;
     }
 
-    std::vector<std::pair<AVPacket*, int64_t>> encoded_chunks(frames.size());
+    encoder.fifo = av_audio_fifo_alloc(config.sample_fmt, config.ch_layout.nb_channels, encoder.enc_ctx->frame_size);
+    encoder.staging = av_frame_alloc();
+    if (!encoder.fifo || !encoder.staging) {
+        std::cerr << "Could not allocate encoder buffers" << std::endl;
+        close_frame_encoder(encoder);
+        return false;
+    }
+    encoder.staging->nb_samples = encoder.enc_ctx->frame_size;
+    encoder.staging->format = config.sample_fmt;
+    encoder.staging->sample_rate = config.sample_rate;
+    av_channel_layout_copy(&encoder.staging->ch_layout, &config.ch_layout);
+    if (av_frame_get_buffer(encoder.staging, 0) < 0) {
+        std::cerr << "Could not allocate encoder frame" << std::endl;
+        close_frame_encoder(encoder);
+        return false;
+    }
+    encoder.next_pts = first_pts;
+    return true;
+}
 
-    #pragma omp parallel for
-    for (size_t i = 0; i < frames.size(); i++) {
-        AVFrame* frame = frames[i].first;
-        AVPacket* pkt = av_packet_alloc();
-        
-        // Encode the frame
-        int ret = avcodec_send_frame(enc_ctx, frame);
-        if (ret < 0) {
-            // Handle error
-            av_packet_free(&pkt);
-            continue;
+// Send one frame (nullptr flushes) and collect every packet that is ready
+bool encode_staged_frame(FrameEncoder &encoder, AVFrame *frame, std::vector<AVPacket*> &packets) {
+    if (avcodec_send_frame(encoder.enc_ctx, frame) < 0) {
+        std::cerr << "Error sending frame to encoder" << std::endl;
+        return false;
+    }
+    while (true) {
+        AVPacket *packet = av_packet_alloc();
+        if (avcodec_receive_packet(encoder.enc_ctx, packet) < 0) {
+            av_packet_free(&packet);
+            break;
         }
+        packets.push_back(packet);
+    }
+    return true;
+}
 
-        ret = avcodec_receive_packet(enc_ctx, pkt);
-        if (ret < 0) {
-            // Handle error
-            av_packet_free(&pkt);
-            continue;
+// Queue the part of a decoded frame (starting at output sample position) that
+// falls inside [range_start, range_end) and encode every full encoder frame it
+// completes.
+bool encode_frame(FrameEncoder &encoder, const AVFrame *frame, int64_t position,
+                  int64_t range_start, int64_t range_end, std::vector<AVPacket*> &packets) {
+    int64_t first = std::max(position, range_start);
+    int64_t last = std::min(position + frame->nb_samples, range_end);
+    if (first < last) {
+        int offset = first - position;
+        int count = last - first;
+        int planes = av_sample_fmt_is_planar((AVSampleFormat)frame->format) ? frame->ch_layout.nb_channels : 1;
+        int sample_bytes = av_get_bytes_per_sample((AVSampleFormat)frame->format) *
+                           (planes == 1 ? frame->ch_layout.nb_channels : 1);
+        std::vector<uint8_t*> data(planes);
+        for (int plane = 0; plane < planes; plane++) {
+            data[plane] = frame->extended_data[plane] + offset * sample_bytes;
+        }
+        if (av_audio_fifo_write(encoder.fifo, (void**)data.data(), count) < count) {
+            std::cerr << "Could not queue samples for encoding" << std::endl;
+            return false;
         }
+    }
 
-        encoded_chunks[i] = { pkt, frames[i].second }; // Store encoded packet with timestamp
+    int frame_size = encoder.enc_ctx->frame_size;
+    while (av_audio_fifo_size(encoder.fifo) >= frame_size) {
+        if (av_frame_make_writable(encoder.staging) < 0) {
+            return false;
+        }
+        encoder.staging->nb_samples = av_audio_fifo_read(encoder.fifo, (void**)encoder.staging->extended_data, frame_size);
+        encoder.staging->pts = encoder.next_pts;
+        encoder.next_pts += encoder.staging->nb_samples;
+        if (!encode_staged_frame(encoder, encoder.staging, packets)) {
+            return false;
+        }
     }
+    return true;
+}
 
-    // Write to output file in order
-    std::ofstream output(output_file, std::ios::binary);
-    for (const auto& encoded_chunk : encoded_chunks) {
-        AVPacket* pkt = encoded_chunk.first;
-        output.write(reinterpret_cast<const char*>(pkt->data), pkt->size);
-        av_packet_free(&pkt); // Free the packet after writing
+// Encode what is left in the FIFO as a short last frame and drain the encoder
+bool flush_frame_encoder(FrameEncoder &encoder, std::vector<AVPacket*> &packets) {
+    int remaining = av_audio_fifo_size(encoder.fifo);
+    if (remaining > 0) {
+        if (av_frame_make_writable(encoder.staging) < 0) {
+            return false;
+        }
+        encoder.staging->nb_samples = av_audio_fifo_read(encoder.fifo, (void**)encoder.staging->extended_data, remaining);
+        encoder.staging->pts = encoder.next_pts;
+        encoder.next_pts += remaining;
+        if (!encode_staged_frame(encoder, encoder.staging, packets)) {
+            return false;
+        }
     }
+    return encode_staged_frame(encoder, nullptr, packets);
+}
 
-    // Clean up
-    avcodec_free_context(&enc_ctx);
-    output.close();
+// Learn the encoder's frame size and delay, which fix the chunk grid
+bool probe_encoder(EncoderConfig &config) {
+    FrameEncoder probe;
+    if (!open_frame_encoder(probe, config, 0)) {
+        return false;
+    }
+    config.frame_size = probe.enc_ctx->frame_size;
+    config.initial_padding = probe.enc_ctx->initial_padding;
+    close_frame_encoder(probe);
+    return config.frame_size > 0;
 }
 
-int main() {
-    std::string input_file = "Sample_mp3_1.mp3";
-    std::string output_file = "sample_out.mp3";
-    int chunk_duration = 10; // Chunk size in seconds
+// Parallel encode mode: decode the chunk straight into a private encoder over
+// its feed range and keep exactly the packets that belong to [out_start,
+// out_end). Frames are freed as soon as they are encoded. All encoders start
+// on a multiple of the frame size, so packet k of any chunk lands on the same
+// grid as it would in one long encode, shifted back by the encoder delay.
+bool encode_chunk(DecoderWorker &worker, const PacketIndex &index, const EncoderConfig &config,
+                  const Chunk &chunk, bool last_chunk, std::vector<AVPacket*> &packets) {
+    FrameEncoder encoder;
+    if (!open_frame_encoder(encoder, config, chunk.feed_start)) {
+        return false;
+    }
+
+    std::vector<AVPacket*> encoded;
+    bool ok = decode_audio_chunk(worker, index, chunk, [&](AVFrame *frame, int64_t position) {
+        process_decoded_frame(frame);
+        bool sent = encode_frame(encoder, frame, position, chunk.feed_start, chunk.feed_end, encoded);
+        av_frame_free(&frame);
+        return sent;
+    });
+    ok = ok && flush_frame_encoder(encoder, encoded);
+    close_frame_encoder(encoder);
+
+    int64_t keep_start = chunk.out_start - config.initial_padding;
+    int64_t keep_end = chunk.out_end - config.initial_padding;
+    for (auto& packet : encoded) {
+        if (ok && packet->pts >= keep_start && (last_chunk || packet->pts < keep_end)) {
+            packets.push_back(packet);
+        } else {
+            av_packet_free(&packet);
+        }
+    }
+    return ok;
+}
 
+// Decode the input chunk-parallel and hand each chunk's output to consume() in
+// file order. In parallel encode mode the workers also encode their chunk and
+// the output carries packets, otherwise it carries processed frames.
+// consume() always runs on the same thread, the output is freed once it
+// returns, and returning false stops the run.
+bool decode_data(const std::string &input_file, double chunk_seconds, int64_t memory_budget,
+                 EncoderConfig &config, ChunkPlan &plan,
+                 const std::function<bool(const Chunk&, ChunkOutput&)> &consume) {
     // Initialize FFmpeg
-    // av_register_all(); // This is not needed for newer FFmpeg versions
+    //av_register_all();
 
-    std::vector<std::pair<AVFrame*, int64_t>> decoded_frames = decode_data(input_file, chunk_duration);
+    // Index the input once (or reuse the cached index)
+    PacketIndex index;
+    if (!load_or_build_packet_index(input_file, index)) {
+        return false;
+    }
 
-    if (decoded_frames.empty()) {
-        std::cerr << "No frames were decoded. Exiting." << std::endl;
-        return 1;
+    // The encoder takes whatever the decoder produces
+    DecoderWorker probe;
+    if (!open_decoder_worker(input_file, index, probe)) {
+        return false;
+    }
+    config.sample_fmt = probe.dec_ctx->sample_fmt;
+    config.sample_rate = index.sample_rate;
+    config.total_samples = index_total_samples(index);
+    av_channel_layout_default(&config.ch_layout, index.channels);
+    close_decoder_worker(probe);
+    if (!probe_encoder(config)) {
+        return false;
+    }
+
+    // Fresh chunk encoders need real audio ahead of their first kept packet
+    // (encoder delay plus transform overlap) and after their last one
+    int64_t preroll = 0;
+    int64_t postroll = 0;
+    if (config.chunked) {
+        preroll = ((config.initial_padding + config.frame_size - 1) / config.frame_size + 2) * config.frame_size;
+        postroll = 2 * config.frame_size;
+    }
+
+    // What a chunk holds until the consumer takes it: its encoded packets in
+    // parallel encode mode (frames are encoded as they are decoded), otherwise
+    // all of its decoded frames
+    double bytes_per_sample = config.chunked ? config.bit_rate / 8.0 / config.sample_rate
+                                             : (double)index.channels * av_get_bytes_per_sample(config.sample_fmt);
+    plan = plan_chunks(index, omp_get_max_threads(), chunk_seconds, config.frame_size, preroll, postroll,
+                       bytes_per_sample, memory_budget);
+    auto chunks = create_chunks(index, plan, preroll, postroll);
+
+    ChunkReorderBuffer reorder(chunks.size(), plan.window);
+    std::atomic<size_t> next_chunk(0);
+
+    // Placement of the team comes from the environment, see Affinity.h. A
+    // worker's decoder, frames and encoder are allocated on its own thread,
+    // so pinned workers keep their chunk data on their own node.
+    CpuPlacement placement(affinity_policy_from_env(), omp_get_max_threads() + 1);
+
+    // Thread 0 consumes in order, the remaining threads decode
+    #pragma omp parallel num_threads(omp_get_max_threads() + 1)
+    {
+        placement.pin_current_thread(omp_get_thread_num());
+        bool consumer = omp_get_thread_num() == 0;
+        bool decoder = !consumer || omp_get_num_threads() == 1;
+
+        // Each worker decodes its chunks through its own input and decoder
+        DecoderWorker worker;
+        if (decoder && !open_decoder_worker(input_file, index, worker)) {
+            // A worker without an input would leave holes in the output
+            reorder.abort();
+            decoder = false;
+        }
+
+        while (decoder && !reorder.is_aborted()) {
+            size_t i = next_chunk++;
+            if (i >= chunks.size() || !reorder.wait_for_turn(i)) {
+                break;
+            }
+            ChunkOutput output;
+            bool ok;
+            if (config.chunked) {
+                ok = encode_chunk(worker, index, config, chunks[i], i + 1 == chunks.size(), output.packets);
+            } else {
+                ok = decode_audio_chunk(worker, index, chunks[i], [&](AVFrame *frame, int64_t position) {
+                    process_decoded_frame(frame); // Stateless, so it stays on the worker
+                    output.frames.emplace_back(frame, position);
+                    return true;
+                });
+            }
+            if (!ok) {
+                reorder.abort();
+            }
+            reorder.push(i, output);
+
+            if (consumer) {
+                // Single thread team: chunks complete in order, hand each on at once
+                if (reorder.pop_next(output) && !consume(chunks[i], output)) {
+                    reorder.abort();
+                }
+                output.clear();
+            }
+        }
+        close_decoder_worker(worker);
+
+        if (consumer && !decoder) {
+            ChunkOutput output;
+            for (size_t i = 0; reorder.pop_next(output); i++) {
+                if (!consume(chunks[i], output)) {
+                    reorder.abort();
+                }
+                output.clear();
+            }
+        }
     }
 
-    int sample_rate = decoded_frames[0].first->sample_rate;
-    for (const auto& frame_pair : decoded_frames) {
-        if (frame_pair.first->sample_rate != sample_rate) {
-            std::cerr << "Inconsistent sample rates detected!" << std::endl;
-            // Clean up decoded frames before exiting
-            for (auto& fp : decoded_frames) {
-                av_frame_free(&(fp.first));
+    return !reorder.is_aborted() && !chunks.empty();
+}
+
+// MP3 output through the libavformat muxer, so the file gets its ID3v2 tag,
+// Xing/LAME info frame and seek table. The muxer writes through a custom
+// AVIOContext on a plain fd: header and trailer updates go out with pwrite()
+// at the muxer's position, while audio is placed a whole chunk at a time by
+// commit_packets() and only accounted for by the muxer.
+struct MuxedOutput {
+    int fd = -1;
+    AVFormatContext *fmt_ctx = nullptr;
+    AVStream *stream = nullptr;
+    AVRational packet_time_base = {0, 1};
+    int64_t position = 0;     // Muxer's write position
+    int64_t file_end = 0;     // Highest byte written so far
+    int64_t placed_start = 0; // Audio bytes already on disk, muxer writes here are skipped
+    int64_t placed_end = 0;
+};
+
+bool pwrite_all(int fd, const uint8_t *data, size_t size, int64_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-            return 1;
+            return false;
         }
+        data += written;
+        size -= written;
+        offset += written;
     }
+    return true;
+}
 
-    for (auto& frame_pair : decoded_frames) {
-        process_decoded_frame(frame_pair.first);
+#if LIBAVFORMAT_VERSION_MAJOR < 61
+int muxed_output_write(void *opaque, uint8_t *buf, int buf_size) {
+#else
+int muxed_output_write(void *opaque, const uint8_t *buf, int buf_size) {
+#endif
+    MuxedOutput *output = static_cast<MuxedOutput*>(opaque);
+    int64_t start = output->position;
+    int64_t end = start + buf_size;
+    // Write whatever falls outside the placed audio region
+    int64_t skip_start = std::min(std::max(output->placed_start, start), end);
+    int64_t skip_end = std::min(std::max(output->placed_end, skip_start), end);
+    if (!pwrite_all(output->fd, buf, skip_start - start, start) ||
+        !pwrite_all(output->fd, buf + (skip_end - start), end - skip_end, skip_end)) {
+        return AVERROR(errno);
     }
+    output->position = end;
+    output->file_end = std::max(output->file_end, end);
+    return buf_size;
+}
 
-    encode_audio_chunks(decoded_frames, output_file);
+int64_t muxed_output_seek(void *opaque, int64_t offset, int whence) {
+    MuxedOutput *output = static_cast<MuxedOutput*>(opaque);
+    switch (whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE:
+            return output->file_end;
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += output->position;
+            break;
+        case SEEK_END:
+            offset += output->file_end;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    if (offset < 0) {
+        return AVERROR(EINVAL);
+    }
+    output->position = offset;
+    return offset;
+}
 
-    // Clean up
-    for (auto& frame_pair : decoded_frames) {
-        av_frame_free(&(frame_pair.first));
+void close_muxed_output(MuxedOutput &output) {
+    if (output.fmt_ctx) {
+        if (output.fmt_ctx->pb) {
+            av_freep(&output.fmt_ctx->pb->buffer);
+            avio_context_free(&output.fmt_ctx->pb);
+        }
+        avformat_free_context(output.fmt_ctx);
+        output.fmt_ctx = nullptr;
+    }
+    if (output.fd >= 0) {
+        close(output.fd);
+        output.fd = -1;
+    }
+}
+
+bool open_muxed_output(MuxedOutput &output, const std::string &output_file, const EncoderConfig &config) {
+    output.fd = open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output.fd < 0) {
+        std::cerr << "Could not open output file '" << output_file << "'" << std::endl;
+        return false;
+    }
+
+    if (avformat_alloc_output_context2(&output.fmt_ctx, nullptr, "mp3", output_file.c_str()) < 0) {
+        std::cerr << "Could not create MP3 muxer" << std::endl;
+        close_muxed_output(output);
+        return false;
+    }
+    const int io_buffer_size = 64 * 1024;
+    unsigned char *io_buffer = static_cast<unsigned char*>(av_malloc(io_buffer_size));
+    AVIOContext *io = io_buffer ? avio_alloc_context(io_buffer, io_buffer_size, 1, &output, nullptr,
+                                                     muxed_output_write, muxed_output_seek) : nullptr;
+    if (!io) {
+        av_free(io_buffer);
+        std::cerr << "Could not allocate output I/O context" << std::endl;
+        close_muxed_output(output);
+        return false;
+    }
+    output.fmt_ctx->pb = io;
+    output.fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    // The stream parameters come from an encoder configured like the real ones
+    FrameEncoder probe;
+    output.stream = avformat_new_stream(output.fmt_ctx, nullptr);
+    if (!output.stream || !open_frame_encoder(probe, config, 0) ||
+        avcodec_parameters_from_context(output.stream->codecpar, probe.enc_ctx) < 0) {
+        std::cerr << "Could not set up output stream" << std::endl;
+        close_frame_encoder(probe);
+        close_muxed_output(output);
+        return false;
+    }
+    output.packet_time_base = probe.enc_ctx->time_base;
+    output.stream->time_base = probe.enc_ctx->time_base;
+    close_frame_encoder(probe);
+
+    if (avformat_write_header(output.fmt_ctx, nullptr) < 0) {
+        std::cerr << "Could not write output header" << std::endl;
+        close_muxed_output(output);
+        return false;
+    }
+    avio_flush(io);
+
+    // Reserve the expected size up front so chunk writes extend nothing
+    int64_t estimate = output.file_end + config.bit_rate / 8 * config.total_samples / config.sample_rate;
+    if (estimate > output.file_end) {
+        posix_fallocate(output.fd, 0, estimate); // Only a hint, writes work without it
+    }
+    return true;
+}
+
+// Place a chunk's packets right after everything committed so far with one
+// pwrite(), then pass them through the muxer so its frame count, seek table
+// and CRC for the Xing/LAME frame cover them. Consumes the packets.
+bool commit_packets(MuxedOutput &output, std::vector<AVPacket*> &packets) {
+    std::vector<uint8_t> bytes;
+    for (auto& packet : packets) {
+        bytes.insert(bytes.end(), packet->data, packet->data + packet->size);
     }
+    int64_t offset = avio_tell(output.fmt_ctx->pb);
+    if (!pwrite_all(output.fd, bytes.data(), bytes.size(), offset)) {
+        std::cerr << "Error writing output file" << std::endl;
+        free_packets(packets);
+        return false;
+    }
+    output.placed_start = offset;
+    output.placed_end = offset + bytes.size();
+
+    bool ok = true;
+    for (auto& packet : packets) {
+        packet->stream_index = output.stream->index;
+        av_packet_rescale_ts(packet, output.packet_time_base, output.stream->time_base);
+        ok = ok && av_write_frame(output.fmt_ctx, packet) >= 0;
+    }
+    free_packets(packets);
+    avio_flush(output.fmt_ctx->pb);
+    output.placed_start = output.placed_end = 0;
 
-    return 0;
+    // The muxer copies audio packets verbatim, anything else means the placed
+    // bytes are not what it accounted for
+    if (!ok || avio_tell(output.fmt_ctx->pb) != offset + (int64_t)bytes.size()) {
+        std::cerr << "Error muxing output packets" << std::endl;
+        return false;
+    }
+    return true;
 }
 
+// Write the trailer (rewrites the Xing/LAME frame) and trim the reservation
+bool finish_muxed_output(MuxedOutput &output) {
+    if (av_write_trailer(output.fmt_ctx) < 0) {
+        std::cerr << "Error writing output trailer" << std::endl;
+        return false;
+    }
+    avio_flush(output.fmt_ctx->pb);
+    if (output.fmt_ctx->pb->error < 0 || ftruncate(output.fd, output.file_end) < 0) {
+        std::cerr << "Error finishing output file" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    if (argc < 3 || argc > 6) {
+        std::cerr << "Usage: " << argv[0] << " <input_file> <output_file> [chunk_seconds] [memory_budget_mb] [parallel|serial]" << std::endl;
+        return 1;
+    }
+
+    std::string input_file = argv[1];
+    std::string output_file = argv[2];
+    double chunk_seconds = argc >= 4 ? std::atof(argv[3]) : 0.0; // Chunk size in seconds, 0 picks one automatically
+    int64_t memory_budget = (argc >= 5 ? std::atoll(argv[4]) : 256) * 1024 * 1024; // Chunk data in flight, in MiB, 0 for no limit
+    std::string encode_mode = argc >= 6 ? argv[5] : "parallel";
+    if (encode_mode != "parallel" && encode_mode != "serial") {
+        std::cerr << "Unknown encode mode '" << encode_mode << "', expected parallel or serial" << std::endl;
+        return 1;
+    }
+    bool parallel_encode = encode_mode == "parallel"; // One encoder per chunk; serial keeps one encoder with bit reservoir
+
+    // Initialize FFmpeg
+    // av_register_all(); // This is not needed for newer FFmpeg versions
+
+    EncoderConfig config;
+    config.chunked = parallel_encode;
+    MuxedOutput output;
+    FrameEncoder encoder;
+    std::vector<AVPacket*> packets;
+
+    // Chunks arrive here in order while later chunks are still being worked on
+    ChunkPlan plan;
+    bool converted = decode_data(input_file, chunk_seconds, memory_budget, config, plan, [&](const Chunk &chunk, ChunkOutput &chunk_output) {
+        if (!output.fmt_ctx && !open_muxed_output(output, output_file, config)) {
+            return false;
+        }
+        if (config.chunked) {
+            return commit_packets(output, chunk_output.packets);
+        }
+        if (!encoder.enc_ctx && !open_frame_encoder(encoder, config, 0)) {
+            return false;
+        }
+        for (auto& frame_pair : chunk_output.frames) {
+            AVFrame *frame = frame_pair.first;
+            if (frame->sample_rate != config.sample_rate) {
+                std::cerr << "Inconsistent sample rates detected!" << std::endl;
+                return false;
+            }
+            if (!encode_frame(encoder, frame, frame_pair.second, chunk.out_start, chunk.out_end, packets)) {
+                return false;
+            }
+        }
+        return commit_packets(output, packets);
+    });
+
+    if (converted && encoder.enc_ctx) {
+        converted = flush_frame_encoder(encoder, packets) && commit_packets(output, packets);
+    }
+    converted = converted && finish_muxed_output(output);
+    if (!converted) {
+        std::cerr << "Conversion of '" << input_file << "' failed" << std::endl;
+    }
+
+    // Clean up
+    free_packets(packets);
+    close_frame_encoder(encoder);
+    close_muxed_output(output);
+
+    if (converted) {
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> execution_time = end - start;
+        print_chunk_plan(plan, config.sample_rate);
+        std::cout << "Execution time: " << execution_time.count() << " seconds" << std::endl;
+    }
+    av_channel_layout_uninit(&config.ch_layout);
+
+    return converted ? 0 : 1;
+}
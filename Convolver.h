@@ -0,0 +1,265 @@
+#ifndef CONVOLVER_H
+#define CONVOLVER_H
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Long-filter convolution (impulse-response reverb, long FIR) by uniformly
+// partitioned overlap-save in the frequency domain.
+//
+// The impulse response is cut into partitions of block_size samples, each
+// kept as a spectrum. Every block_size input samples, the newest input block
+// is transformed once and pushed onto a delay line of input spectra; the
+// output block is the inverse transform of the sum of spectrum products over
+// all partitions. Per sample that costs one forward and one inverse FFT
+// share plus one complex multiply-add per partition, instead of one
+// multiply-add per impulse-response sample for direct convolution.
+//
+// Two channels share each transform (one as the real part, one as the
+// imaginary part), which works because the impulse response is real.
+//
+// The wet signal comes out block_size samples late (a short pre-delay for a
+// reverb); the dry signal is passed straight through. Input history and the
+// spectrum delay line carry over from frame to frame, so one Convolver
+// serves one stream.
+
+// Precomputed tables for an in-place radix-2 complex FFT of one size
+class FftPlan {
+public:
+    explicit FftPlan(int size) : size_(size), twiddles_(size / 2), reversed_(size) {
+        for (int i = 0; i < size / 2; i++) {
+            double angle = -2.0 * 3.14159265358979323846 * i / size;
+            twiddles_[i] = {(float)std::cos(angle), (float)std::sin(angle)};
+        }
+        int bits = 0;
+        while ((1 << bits) < size) {
+            bits++;
+        }
+        for (int i = 0; i < size; i++) {
+            int r = 0;
+            for (int b = 0; b < bits; b++) {
+                r |= ((i >> b) & 1) << (bits - 1 - b);
+            }
+            reversed_[i] = r;
+        }
+    }
+
+    int size() const { return size_; }
+
+    // Forward transform, or the inverse without the 1/size scaling
+    void transform(std::complex<float> *x, bool inverse) const {
+        for (int i = 0; i < size_; i++) {
+            if (i < reversed_[i]) {
+                std::swap(x[i], x[reversed_[i]]);
+            }
+        }
+        for (int half = 1; half < size_; half *= 2) {
+            int stride = size_ / (2 * half);
+            for (int start = 0; start < size_; start += 2 * half) {
+                for (int k = 0; k < half; k++) {
+                    std::complex<float> w = twiddles_[k * stride];
+                    float wr = w.real(), wi = inverse ? -w.imag() : w.imag();
+                    std::complex<float> &a = x[start + k], &b = x[start + k + half];
+                    // Written out: std::complex's operator* checks for NaN and
+                    // infinity on every multiply
+                    float tr = b.real() * wr - b.imag() * wi;
+                    float ti = b.real() * wi + b.imag() * wr;
+                    b = {a.real() - tr, a.imag() - ti};
+                    a = {a.real() + tr, a.imag() + ti};
+                }
+            }
+        }
+    }
+
+private:
+    int size_;
+    std::vector<std::complex<float>> twiddles_;
+    std::vector<int> reversed_;
+};
+
+// Plans are built once per size and shared; they are read-only after
+// construction, so any thread may use them
+inline const FftPlan &fft_plan(int size) {
+    static std::mutex mutex;
+    static std::map<int, std::unique_ptr<FftPlan>> plans;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<FftPlan> &plan = plans[size];
+    if (!plan) {
+        plan.reset(new FftPlan(size));
+    }
+    return *plan;
+}
+
+// Exponentially decaying noise with a few early reflections, normalized to
+// unit energy: a stand-in room for when no measured response is at hand.
+// rt60 is the time, in seconds, for the tail to fall by 60 dB.
+inline std::vector<float> synthetic_room_impulse(int sample_rate, float seconds, float rt60, uint32_t seed = 1) {
+    std::vector<float> ir(std::max(1, (int)(sample_rate * seconds)));
+    float decay = std::pow(10.0f, -3.0f / (rt60 * sample_rate)); // Per-sample factor for -60 dB at rt60
+    float envelope = 1.0f;
+    for (size_t i = 0; i < ir.size(); i++) {
+        seed = seed * 1664525u + 1013904223u;
+        ir[i] = (int32_t)seed * (1.0f / 2147483648.0f) * envelope;
+        envelope *= decay;
+    }
+    const float reflections[][2] = {{0.007f, 0.8f}, {0.011f, -0.6f}, {0.017f, 0.5f}, {0.023f, -0.4f}};
+    for (const auto& reflection : reflections) {
+        size_t at = (size_t)(reflection[0] * sample_rate);
+        if (at < ir.size()) {
+            ir[at] += reflection[1];
+        }
+    }
+    double energy = 0.0;
+    for (float sample : ir) {
+        energy += (double)sample * sample;
+    }
+    float scale = energy > 0.0 ? (float)(1.0 / std::sqrt(energy)) : 1.0f;
+    for (float &sample : ir) {
+        sample *= scale;
+    }
+    return ir;
+}
+
+class Convolver {
+public:
+    Convolver() = default;
+
+    // Sets the impulse response and stream shape and clears the history.
+    // block_size (a power of two) trades latency against cost per sample.
+    void configure(const std::vector<float> &impulse, int channels, int block_size = 512, int sample_rate = 0) {
+        channels_ = channels;
+        sample_rate_ = sample_rate;
+        block_ = block_size;
+        partitions_ = std::max<int>(1, ((int)impulse.size() + block_ - 1) / block_);
+        plan_ = &fft_plan(2 * block_);
+        const int bins = 2 * block_;
+
+        spectra_.assign((size_t)partitions_ * bins, {0.0f, 0.0f});
+        for (int p = 0; p < partitions_; p++) {
+            std::complex<float> *h = &spectra_[(size_t)p * bins];
+            for (int i = 0; i < block_ && (size_t)p * block_ + i < impulse.size(); i++) {
+                h[i] = {impulse[(size_t)p * block_ + i], 0.0f};
+            }
+            plan_->transform(h, false);
+        }
+
+        int pairs = (channels + 1) / 2;
+        history_.assign((size_t)pairs * partitions_ * bins, {0.0f, 0.0f});
+        head_ = 0;
+        input_.assign((size_t)channels * 2 * block_, 0.0f);
+        wet_.assign((size_t)channels * block_, 0.0f);
+        work_.assign(bins, {0.0f, 0.0f});
+        sum_.assign(bins, {0.0f, 0.0f});
+        fill_ = 0;
+    }
+
+    bool configured_for(int sample_rate, int channels) const {
+        return plan_ && sample_rate_ == sample_rate && channels_ == channels;
+    }
+
+    int block_size() const { return block_; }
+    int partitions() const { return partitions_; }
+
+    // out = dry * in + wet * (in convolved with the impulse response), in
+    // place through a SampleAccess (see SampleFormat.h), clamped to full scale
+    template <typename Access>
+    void process(Access samples, int nb_samples, float dry, float wet) {
+        const ptrdiff_t step = samples.step();
+        for (int start = 0; start < nb_samples;) {
+            int n = std::min(block_ - fill_, nb_samples - start);
+            for (int ch = 0; ch < channels_; ch++) {
+                auto *data = samples.channel(ch) + start * step;
+                float *in = &input_[((size_t)ch * 2 + 1) * block_ + fill_]; // Newer half of the channel's window
+                const float *tail = &wet_[(size_t)ch * block_ + fill_];
+                for (int i = 0; i < n; i++) {
+                    float x = Access::read(data[i * step]);
+                    in[i] = x;
+                    data[i * step] = Access::write(std::clamp(dry * x + wet * tail[i], -1.0f, 1.0f));
+                }
+            }
+            fill_ += n;
+            start += n;
+            if (fill_ == block_) {
+                run_block();
+                fill_ = 0;
+            }
+        }
+    }
+
+private:
+    // acc += x * h over n interleaved complex values. Spelled out on floats,
+    // with no aliasing, so the compiler vectorizes it.
+    static void multiply_add(float *__restrict acc, const float *__restrict x, const float *__restrict h, int n) {
+        for (int i = 0; i < 2 * n; i += 2) {
+            acc[i] += x[i] * h[i] - x[i + 1] * h[i + 1];
+            acc[i + 1] += x[i] * h[i + 1] + x[i + 1] * h[i];
+        }
+    }
+
+    // Convolves the window of the last two input blocks, leaving the newest
+    // block_ output samples in wet_ and sliding the window on
+    void run_block() {
+        const int bins = 2 * block_;
+        const float scale = 1.0f / bins;
+        for (int pair = 0; pair * 2 < channels_; pair++) {
+            int first = pair * 2;
+            bool second = first + 1 < channels_;
+            const float *a = &input_[(size_t)first * 2 * block_];
+            const float *b = second ? &input_[(size_t)(first + 1) * 2 * block_] : nullptr;
+
+            std::complex<float> *x = &history_[((size_t)pair * partitions_ + head_) * bins];
+            for (int i = 0; i < bins; i++) {
+                x[i] = {a[i], b ? b[i] : 0.0f};
+            }
+            plan_->transform(x, false);
+
+            // Partition p meets the input spectrum from p blocks ago
+            std::fill(sum_.begin(), sum_.end(), std::complex<float>(0.0f, 0.0f));
+            for (int p = 0; p < partitions_; p++) {
+                int slot = (head_ - p + partitions_) % partitions_;
+                const std::complex<float> *xp = &history_[((size_t)pair * partitions_ + slot) * bins];
+                multiply_add(reinterpret_cast<float*>(sum_.data()), reinterpret_cast<const float*>(xp),
+                             reinterpret_cast<const float*>(&spectra_[(size_t)p * bins]), bins);
+            }
+
+            std::copy(sum_.begin(), sum_.end(), work_.begin());
+            plan_->transform(work_.data(), true);
+            // The first half of the circular result wraps around; the second
+            // half is the valid output block
+            for (int i = 0; i < block_; i++) {
+                wet_[(size_t)first * block_ + i] = work_[block_ + i].real() * scale;
+                if (second) {
+                    wet_[(size_t)(first + 1) * block_ + i] = work_[block_ + i].imag() * scale;
+                }
+            }
+        }
+        head_ = (head_ + 1) % partitions_;
+
+        for (int ch = 0; ch < channels_; ch++) {
+            float *window = &input_[(size_t)ch * 2 * block_];
+            std::copy(window + block_, window + 2 * block_, window);
+        }
+    }
+
+    int channels_ = 0;
+    int sample_rate_ = 0;
+    int block_ = 0;
+    int partitions_ = 0;
+    const FftPlan *plan_ = nullptr;
+    std::vector<std::complex<float>> spectra_; // [partition][bin]
+    std::vector<std::complex<float>> history_; // [pair][slot][bin], slot head_ newest
+    int head_ = 0;
+    std::vector<float> input_;                 // [channel][previous block, current block]
+    std::vector<float> wet_;                   // [channel][sample] of the last output block
+    std::vector<std::complex<float>> work_, sum_;
+    int fill_ = 0;                             // Samples of the current block received
+};
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef EFFECT_CHAIN_H
+#define EFFECT_CHAIN_H
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+#include <utility>
+#include "SampleFormat.h"
+
+// Runs a chain of effects over a frame with as few sweeps as possible.
+//
+// An effect is either point-wise (each output sample depends only on the
+// same input sample) or a frame stage (it looks at neighbouring samples or
+// at history, like a delay or a smoothing window). run_effect_chain() fuses
+// each run of consecutive point-wise effects into one pass that loads a
+// sample, applies them all in order and stores it once; a frame stage ends
+// the run, runs on its own over the whole frame, and a new run starts after
+// it. The result is the same as applying the effects one by one, for integer
+// formats too: between fused effects each sample is still rounded and
+// saturated to the sample type, only in a register instead of through
+// memory. (For float that round trip is the identity and compiles away.)
+//
+// Point-wise effects are types with
+//     static constexpr bool pointwise = true;
+//     float operator()(float sample) const;
+// working on normalized float. Anything callable as fn(frame, format) can be
+// a frame stage through frame_stage().
+
+// Multiplies by gain, clamped to full scale
+struct Gain {
+    static constexpr bool pointwise = true;
+    float gain;
+
+    float operator()(float sample) const { return std::clamp(sample * gain, -1.0f, 1.0f); }
+};
+
+// Above threshold, the excess is divided by ratio; clamped to full scale
+struct Compressor {
+    static constexpr bool pointwise = true;
+    float threshold;
+    float ratio;
+
+    float operator()(float sample) const {
+        if (std::abs(sample) > threshold) {
+            sample = threshold + (sample - threshold) / ratio;
+        }
+        return std::clamp(sample, -1.0f, 1.0f);
+    }
+};
+
+template <typename Fn>
+struct FrameStage {
+    static constexpr bool pointwise = false;
+    Fn fn;
+
+    void operator()(AVFrame *frame, enum AVSampleFormat format) const { fn(frame, format); }
+};
+
+template <typename Fn>
+FrameStage<Fn> frame_stage(Fn fn) {
+    return FrameStage<Fn>{fn};
+}
+
+// One sweep applying every effect of the tuple to each sample, in order,
+// quantized to the sample type after each effect as a separate sweep would
+template <typename... Effects>
+void run_fused(AVFrame *frame, enum AVSampleFormat format, const std::tuple<Effects...> &effects) {
+    if constexpr (sizeof...(Effects) > 0) {
+        visit_samples(frame, format, [&](auto samples) {
+            using Access = decltype(samples);
+            map_samples(samples, frame->nb_samples, [&](float sample) {
+                std::apply([&](const auto&... effect) {
+                    ((sample = Access::read(Access::write(effect(sample)))), ...);
+                }, effects);
+                return sample;
+            });
+        });
+    }
+}
+
+// pending holds the point-wise effects collected since the last frame stage
+template <typename... Pending>
+void run_effect_chain_from(AVFrame *frame, enum AVSampleFormat format, const std::tuple<Pending...> &pending) {
+    run_fused(frame, format, pending);
+}
+
+template <typename... Pending, typename Effect, typename... Rest>
+void run_effect_chain_from(AVFrame *frame, enum AVSampleFormat format, const std::tuple<Pending...> &pending,
+                           const Effect &effect, const Rest&... rest) {
+    if constexpr (Effect::pointwise) {
+        run_effect_chain_from(frame, format, std::tuple_cat(pending, std::make_tuple(effect)), rest...);
+    } else {
+        run_fused(frame, format, pending);
+        effect(frame, format);
+        run_effect_chain_from(frame, format, std::tuple<>(), rest...);
+    }
+}
+
+// Applies the effects to the frame in the order given
+template <typename... Effects>
+void run_effect_chain(AVFrame *frame, enum AVSampleFormat format, const Effects&... effects) {
+    run_effect_chain_from(frame, format, std::tuple<>(), effects...);
+}
+
+#endif
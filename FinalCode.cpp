@@ -2,11 +2,15 @@
 #include <vector>
 #include <string>
 #include <fstream>
-#include <queue>
-#include <mutex>
-#include <condition_variable>
+#include <iomanip>
 #include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <functional>
 #include <omp.h>
 extern "C" {
     #include <libavformat/avformat.h>
@@ -15,134 +19,510 @@ extern "C" {
     #include <libavutil/opt.h>
     #include <libavutil/channel_layout.h>
     #include <libavutil/samplefmt.h>
+    #include <libavutil/audio_fifo.h>
 }
+#include "BatchQueue.h"
+#include "FramePool.h"
+#include "PacketPool.h"
+#include "StageStats.h"
+#include "Affinity.h"
+#include "SampleFormat.h"
+#include "SimdKernels.h"
 
 using namespace std;
-std::mutex mtx;
-std::condition_variable cv;
-std::queue<AVFrame*> frame_queue; // Queue to hold frames for encoding
-bool finished = false;
 
-// Process audio frame using OpenMP for parallel processing
+// Queue bounds between the pipeline stages, settable on the command line. A
+// queue holds at most its depth in items and its byte limit in payload (0 for
+// no byte limit); a full queue blocks the stage feeding it. Stages hand items
+// over in batches of up to batch_items items, cut early once a batch of frames
+// reaches batch_samples samples (0: no sample limit). dsp_workers threads run
+// the DSP stage (0: one per core not taken by the other stages). affinity
+// decides where the stage threads run, see Affinity.h.
+struct PipelineConfig {
+    size_t packet_queue_depth = 32;              // demux -> decode and encode -> mux
+    size_t packet_queue_bytes = 256 * 1024;
+    size_t frame_queue_depth = 16;               // decode -> DSP -> resample -> encode
+    size_t frame_queue_bytes = 2 * 1024 * 1024;
+    int batch_items = 8;
+    int64_t batch_samples = 0;
+    int dsp_workers = 0;
+    AffinityPolicy affinity = AffinityPolicy::none;
+};
+
+// Everything the stage threads share. Each stage owns its codec or format
+// context and talks to its neighbours only through the queues, one producer
+// and one consumer per queue.
+//
+// The DSP stage is spread over several workers. Decode deals frame batches
+// round-robin to the workers' input queues, numbering them in stream order;
+// resample takes batch n back from worker n % N, so output order is the
+// input order whatever the workers' relative speed.
+struct Pipeline {
+    AVFormatContext *input_format_ctx = nullptr;
+    int audio_stream_index = -1;
+    AVCodecContext *decoder_ctx = nullptr;
+    SwrContext *swr_ctx = nullptr;
+    AVCodecContext *encoder_ctx = nullptr;
+    AVFormatContext *output_format_ctx = nullptr;
+
+    BatchQueue<AVPacket*> demuxed;
+    std::vector<std::unique_ptr<BatchQueue<AVFrame*>>> to_dsp;   // decode -> DSP worker i
+    std::vector<std::unique_ptr<BatchQueue<AVFrame*>>> from_dsp; // DSP worker i -> resample
+    BatchQueue<AVFrame*> resampled;
+    BatchQueue<AVPacket*> encoded;
+
+    // Set by the first stage that fails. Stages after that keep draining and
+    // freeing their input so nobody upstream blocks on a full queue.
+    std::atomic<bool> failed{false};
+
+    // Every frame passed between stages comes from and goes back to here
+    FramePool &frames = shared_frame_pool();
+
+    // Packets are owned by the stage that fills them (demux, encode) and
+    // handed back by the one stage that consumes them (decode, mux)
+    PacketPool demuxed_packets;
+    PacketPool encoded_packets;
+
+    // Per-stage counters (items are packets or frames, whichever the stage
+    // produces), and per-effect counters within the DSP stage
+    StageStats demux_stats{"demux"};
+    StageStats decode_stats{"decode"};
+    StageStats dsp_stats{"dsp"};
+    StageStats resample_stats{"resample"};
+    StageStats encode_stats{"encode"};
+    StageStats mux_stats{"mux"};
+    StageStats gain_effect{"gain"};
+
+    // Frames the resample stage allocates and touches up front, so that with
+    // pinned threads they live on its NUMA node
+    int prefill_frames = 0;
+
+    explicit Pipeline(const PipelineConfig &config)
+        : demuxed(config.packet_queue_depth, config.packet_queue_bytes, config.batch_items, 0),
+          resampled(config.frame_queue_depth, config.frame_queue_bytes, config.batch_items, config.batch_samples),
+          encoded(config.packet_queue_depth, config.packet_queue_bytes, config.batch_items, 0),
+          demuxed_packets(2 * (config.packet_queue_depth + config.batch_items)),
+          encoded_packets(2 * (config.packet_queue_depth + config.batch_items)) {
+        // The frame queue bounds are shared out between the workers
+        size_t workers = config.dsp_workers;
+        size_t depth = std::max(config.frame_queue_depth / workers, (size_t)config.batch_items);
+        size_t bytes = config.frame_queue_bytes ? std::max(config.frame_queue_bytes / workers, (size_t)1) : 0;
+        for (size_t i = 0; i < workers; i++) {
+            to_dsp.emplace_back(new BatchQueue<AVFrame*>(depth, bytes, config.batch_items, config.batch_samples));
+            to_dsp.back()->number_batches(i, workers);
+            from_dsp.emplace_back(new BatchQueue<AVFrame*>(depth, bytes, config.batch_items, config.batch_samples));
+        }
+    }
+
+    void fail(const char *message) {
+        if (!failed.exchange(true)) {
+            std::cerr << message << std::endl;
+        }
+    }
+};
+
+// Process audio frame: volume boost by 80%, clamped to full scale
 void process_audio_frame(AVFrame* frame, enum AVSampleFormat format) {
-    // Simple volume adjustment (increase volume by 10%)
-    /*omp_set_num_threads(2);
-    #pragma omp parallel sections
-    {
-    	#pragma omp section 
-    	{*/
-    	for (int i = 0; i < frame->nb_samples/2; i++) {
-        	for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-        	    switch (format) {
-        	        case AV_SAMPLE_FMT_FLT:
-        	        case AV_SAMPLE_FMT_FLTP: {
-        	            float* sample = (float*)frame->data[ch] + i;
-        	            *sample *= 1.8f;
-        	            *sample = std::clamp(*sample, -1.0f, 1.0f);
-        	            break;
-        	        }
-        	        case AV_SAMPLE_FMT_S16:
-        	        case AV_SAMPLE_FMT_S16P: {
-        	            int16_t* sample = (int16_t*)frame->data[ch] + i;
-        	            int32_t temp = *sample * 1.8;
-        	            *sample = std::clamp(temp, (int32_t)INT16_MIN, (int32_t)INT16_MAX);
-        	            break;
-        	        }
-        	        case AV_SAMPLE_FMT_S32:
-        	        case AV_SAMPLE_FMT_S32P: {
-        	            int32_t* sample = (int32_t*)frame->data[ch] + i;
-        	            int64_t temp = *sample * 1.8;
-        	            *sample = std::clamp(temp, (int64_t)INT32_MIN, (int64_t)INT32_MAX);
-        	            break;
-        	        }
-        	        default:
-        	            break;
-        	    }
-        	}
-    	}
-    	//}
-    	
-    	/*#pragma omp section 
-    	{*/
-    	for (int i = frame->nb_samples/2; i < frame->nb_samples; i++) {
-        	for (int ch = 0; ch < frame->ch_layout.nb_channels; ch++) {
-        	    switch (format) {
-        	        case AV_SAMPLE_FMT_FLT:
-        	        case AV_SAMPLE_FMT_FLTP: {
-        	            float* sample = (float*)frame->data[ch] + i;
-        	            *sample *= 1.8f;
-        	            *sample = std::clamp(*sample, -1.0f, 1.0f);
-        	            break;
-        	        }
-        	        case AV_SAMPLE_FMT_S16:
-        	        case AV_SAMPLE_FMT_S16P: {
-        	            int16_t* sample = (int16_t*)frame->data[ch] + i;
-        	            int32_t temp = *sample * 1.8;
-        	            *sample = std::clamp(temp, (int32_t)INT16_MIN, (int32_t)INT16_MAX);
-        	            break;
-        	        }
-        	        case AV_SAMPLE_FMT_S32:
-        	        case AV_SAMPLE_FMT_S32P: {
-        	            int32_t* sample = (int32_t*)frame->data[ch] + i;
-        	            int64_t temp = *sample * 1.8;
-        	            *sample = std::clamp(temp, (int64_t)INT32_MIN, (int64_t)INT32_MAX);
-        	            break;
-        	        }
-        	        default:
-        	            break;
-        	    }
-        	}
-    	}
-    	//}
-    //}
+    const SimdKernels &kernels = simd_kernels();
+    visit_samples(frame, format, [&](auto samples) {
+        for (int p = 0; p < samples.planes(); p++) {
+            simd_map(samples.plane(p), samples.plane_size(frame->nb_samples), [&](float* block, int n) {
+                kernels.gain_clamp(block, n, 1.8f, -1.0f, 1.0f);
+            });
+        }
+    });
 }
 
 
-void encoder_thread(AVCodecContext *encoder_ctx, AVFormatContext *output_format_ctx) {
-    while (true) {
-        AVFrame* frame;
+// What a queued frame or packet costs in memory
+size_t frame_bytes(const AVFrame *frame) {
+    size_t bytes = 0;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++) {
+        bytes += frame->buf[i]->size;
+    }
+    for (int i = 0; i < frame->nb_extended_buf; i++) {
+        bytes += frame->extended_buf[i]->size;
+    }
+    return bytes;
+}
 
-        {
-            std::unique_lock<std::mutex> lock(mtx);
-            cv.wait(lock, [] { return !frame_queue.empty() || finished; });
+size_t packet_bytes(const AVPacket *packet) {
+    return packet->buf ? packet->buf->size : packet->size;
+}
 
-            if (!frame_queue.empty()) {
-                frame = frame_queue.front();
-                frame_queue.pop();
-            } else {
-                break; // Exit if no more frames and finished is true
+// Demux: read packets of the audio stream
+void demux_stage(Pipeline &p) {
+    StageTimer timer(p.demux_stats);
+    AVPacket *packet = p.demuxed_packets.get();
+    while (!p.failed && av_read_frame(p.input_format_ctx, packet) >= 0) {
+        if (packet->stream_index == p.audio_stream_index) {
+            p.demux_stats.count(1);
+            p.demuxed.push(packet, packet_bytes(packet));
+            packet = p.demuxed_packets.get();
+        } else {
+            av_packet_unref(packet);
+        }
+    }
+    p.demuxed_packets.put(packet);
+    p.demuxed.close();
+}
+
+// Decode: packets to frames in the decoder's own format, drained at the end.
+// Each completed batch goes to the next DSP worker in turn.
+void decode_stage(Pipeline &p) {
+    StageTimer timer(p.decode_stats);
+    AVFrame *frame = p.frames.get_empty();
+    size_t worker = 0;
+    auto receive_frames = [&] {
+        while (avcodec_receive_frame(p.decoder_ctx, frame) == 0) {
+            p.decode_stats.count(1, frame->nb_samples);
+            if (p.to_dsp[worker]->push(frame, frame_bytes(frame), frame->nb_samples)) {
+                worker = (worker + 1) % p.to_dsp.size();
+            }
+            frame = p.frames.get_empty();
+        }
+    };
+
+    Batch<AVPacket*> batch;
+    while (p.demuxed.pop(batch)) {
+        for (int i = 0; i < batch.count; i++) {
+            AVPacket *packet = batch.items[i];
+            if (!p.failed && avcodec_send_packet(p.decoder_ctx, packet) < 0) {
+                p.fail("Error submitting packet for decoding");
+            }
+            p.demuxed_packets.give_back(packet);
+            if (!p.failed) {
+                receive_frames();
             }
         }
+    }
+    if (!p.failed) {
+        avcodec_send_packet(p.decoder_ctx, nullptr);
+        receive_frames();
+    }
+    p.frames.put(frame);
+    for (auto& queue : p.to_dsp) {
+        queue->close();
+    }
+}
 
-        // Send frame to encoder
-        if (avcodec_send_frame(encoder_ctx, frame) < 0) {
-            std::cerr << "Error sending frame to encoder" << std::endl;
-            break;
+// DSP worker: process its share of the batches in place and pass each batch
+// on whole, so its sequence number survives. After a failure batches still
+// go through unprocessed and resample frees them.
+void dsp_stage(Pipeline &p, size_t worker) {
+    BatchQueue<AVFrame*> &in = *p.to_dsp[worker];
+    BatchQueue<AVFrame*> &out = *p.from_dsp[worker];
+    StageTimer timer(p.dsp_stats);
+    Batch<AVFrame*> batch;
+    while (in.pop(batch)) {
+        p.dsp_stats.count(batch.count, batch.samples);
+        uint64_t start = stage_clock_ns();
+        for (int i = 0; i < batch.count && !p.failed; i++) {
+            // Process audio in its original format (optional)
+            process_audio_frame(batch.items[i], (enum AVSampleFormat)batch.items[i]->format);
         }
+        p.gain_effect.add_time(stage_clock_ns() - start);
+        p.gain_effect.count(batch.count, batch.samples);
+        out.push_batch(batch);
+    }
+    out.close();
+}
 
-        AVPacket *output_packet = av_packet_alloc();
-        while (avcodec_receive_packet(encoder_ctx, output_packet) == 0) {
-            output_packet->stream_index = 0;
-            av_packet_rescale_ts(output_packet, encoder_ctx->time_base, output_format_ctx->streams[0]->time_base);
-            if (av_interleaved_write_frame(output_format_ctx, output_packet) < 0) {
-                std::cerr << "Error writing output packet" << std::endl;
+// Resample: put the DSP workers' batches back in stream order, convert to the
+// encoder's format and re-cut into frames of exactly the encoder's frame size
+// (the last one may be short), numbered in samples
+void resample_stage(Pipeline &p) {
+    StageTimer timer(p.resample_stats);
+    AVCodecContext *enc = p.encoder_ctx;
+    AVAudioFifo *fifo = av_audio_fifo_alloc(enc->sample_fmt, enc->ch_layout.nb_channels, 4 * enc->frame_size);
+    AVFrame *converted = nullptr; // Scratch for swr output, only replaced when a frame needs more room
+    int64_t next_pts = 0;
+    if (!fifo) {
+        p.fail("Could not allocate resampler buffers");
+    }
+    p.frames.prefill(enc->sample_fmt, enc->ch_layout, enc->frame_size, p.prefill_frames);
+
+    auto convert = [&](const AVFrame *frame) {
+        int in_samples = frame ? frame->nb_samples : 0;
+        int capacity = swr_get_out_samples(p.swr_ctx, in_samples);
+        if (!converted || converted->nb_samples < capacity) {
+            p.frames.put(converted);
+            converted = p.frames.get(enc->sample_fmt, enc->ch_layout, enc->sample_rate, std::max(capacity, enc->frame_size));
+        }
+        int out_samples = converted ? swr_convert(p.swr_ctx, converted->data, converted->nb_samples,
+                                                  frame ? (const uint8_t**)frame->extended_data : nullptr, in_samples) : -1;
+        if (out_samples < 0 || av_audio_fifo_write(fifo, (void**)converted->data, out_samples) < out_samples) {
+            p.fail("Error resampling audio frame");
+        }
+    };
+    auto emit_frames = [&](bool final) {
+        while (!p.failed && (av_audio_fifo_size(fifo) >= enc->frame_size || (final && av_audio_fifo_size(fifo) > 0))) {
+            int nb_samples = std::min(enc->frame_size, av_audio_fifo_size(fifo));
+            AVFrame *out = p.frames.get(enc->sample_fmt, enc->ch_layout, enc->sample_rate, nb_samples);
+            if (!out) {
+                p.fail("Could not allocate resampled frame");
                 break;
             }
+            av_audio_fifo_read(fifo, (void**)out->data, nb_samples);
+            out->pts = next_pts;
+            next_pts += nb_samples;
+            p.resample_stats.count(1, nb_samples);
+            p.resampled.push(out, frame_bytes(out), nb_samples);
+        }
+    };
+
+    // Batch n can only be on worker n % N; once that worker is closed and
+    // drained there is no batch n, so the stream has ended
+    Batch<AVFrame*> batch;
+    uint64_t next_sequence = 0;
+    while (p.from_dsp[next_sequence % p.from_dsp.size()]->pop(batch)) {
+        if (batch.sequence != next_sequence) {
+            p.fail("DSP batches out of order");
+        }
+        next_sequence++;
+        for (int i = 0; i < batch.count; i++) {
+            if (!p.failed) {
+                convert(batch.items[i]);
+                emit_frames(false);
+            }
+            p.frames.put(batch.items[i]);
+        }
+    }
+    for (auto& queue : p.from_dsp) {
+        while (queue->pop(batch)) { // Only left over after a failure
+            for (int i = 0; i < batch.count; i++) {
+                p.frames.put(batch.items[i]);
+            }
+        }
+    }
+    if (!p.failed) {
+        convert(nullptr); // Flush what the resampler still holds
+        emit_frames(true);
+    }
+
+    p.frames.put(converted);
+    if (fifo) {
+        av_audio_fifo_free(fifo);
+    }
+    p.resampled.close();
+}
+
+// Encode: frames to packets, drained at the end
+void encode_stage(Pipeline &p) {
+    StageTimer timer(p.encode_stats);
+    AVPacket *packet = p.encoded_packets.get();
+    auto receive_packets = [&] {
+        while (avcodec_receive_packet(p.encoder_ctx, packet) == 0) {
+            p.encode_stats.count(1, packet->duration);
+            p.encoded.push(packet, packet_bytes(packet));
+            packet = p.encoded_packets.get();
+        }
+    };
+
+    Batch<AVFrame*> batch;
+    while (p.resampled.pop(batch)) {
+        for (int i = 0; i < batch.count; i++) {
+            if (!p.failed && avcodec_send_frame(p.encoder_ctx, batch.items[i]) < 0) {
+                p.fail("Error sending frame to encoder");
+            }
+            p.frames.put(batch.items[i]);
+            if (!p.failed) {
+                receive_packets();
+            }
+        }
+    }
+    if (!p.failed) {
+        avcodec_send_frame(p.encoder_ctx, nullptr);
+        receive_packets();
+    }
+    p.encoded_packets.put(packet);
+    p.encoded.close();
+}
+
+// Mux: write packets to the output file
+void mux_stage(Pipeline &p) {
+    AVStream *out_stream = p.output_format_ctx->streams[0];
+    StageTimer timer(p.mux_stats);
+    Batch<AVPacket*> batch;
+    while (p.encoded.pop(batch)) {
+        for (int i = 0; i < batch.count; i++) {
+            AVPacket *packet = batch.items[i];
+            if (!p.failed) {
+                p.mux_stats.count(1);
+                packet->stream_index = 0;
+                av_packet_rescale_ts(packet, p.encoder_ctx->time_base, out_stream->time_base);
+                if (av_interleaved_write_frame(p.output_format_ctx, packet) < 0) {
+                    p.fail("Error writing output packet");
+                }
+            }
+            p.encoded_packets.give_back(packet);
         }
-        av_packet_free(&output_packet);
-        av_frame_free(&frame); // Free the frame after processing
     }
 }
 
+// Parses --name=value options after the file names. Byte limits take an
+// optional k or m suffix, --affinity takes a policy name. Returns false on anything it does not understand.
+bool parse_pipeline_options(int argc, char *argv[], PipelineConfig &config) {
+    for (int i = 3; i < argc; i++) {
+        if (strncmp(argv[i], "--affinity=", 11) == 0) {
+            if (!parse_affinity_policy(argv[i] + 11, config.affinity)) {
+                return false;
+            }
+            continue;
+        }
+        const char *value = strchr(argv[i], '=');
+        if (!value || value[1] < '0' || value[1] > '9') {
+            return false;
+        }
+        std::string name(argv[i], value - argv[i]);
+        char *suffix;
+        size_t number = strtoull(value + 1, &suffix, 10);
+        size_t scale = 1;
+        if (*suffix == 'k' || *suffix == 'K') {
+            scale = 1024;
+            suffix++;
+        } else if (*suffix == 'm' || *suffix == 'M') {
+            scale = 1024 * 1024;
+            suffix++;
+        }
+        if (*suffix != '\0') {
+            return false;
+        }
+        if (name == "--packet-queue" && number > 0 && scale == 1) {
+            config.packet_queue_depth = number;
+        } else if (name == "--frame-queue" && number > 0 && scale == 1) {
+            config.frame_queue_depth = number;
+        } else if (name == "--packet-queue-bytes") {
+            config.packet_queue_bytes = number * scale;
+        } else if (name == "--frame-queue-bytes") {
+            config.frame_queue_bytes = number * scale;
+        } else if (name == "--batch" && number > 0 && number <= (size_t)Batch<AVFrame*>::kMaxItems && scale == 1) {
+            config.batch_items = (int)number;
+        } else if (name == "--batch-samples" && scale == 1) {
+            config.batch_samples = (int64_t)number;
+        } else if (name == "--dsp-workers" && scale == 1 && number <= 256) {
+            config.dsp_workers = (int)number;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+void print_queue_usage(const char *name, const BatchQueue<T> &queue) {
+    const auto &ring = queue.ring();
+    double per_batch = queue.batches() ? (double)queue.items() / queue.batches() : 0.0;
+    std::cout << "  " << name << ": " << queue.items() << " items in " << queue.batches() << " handoffs ("
+              << per_batch << " per batch), high-water " << ring.high_water() << "/" << ring.capacity()
+              << " batches, " << ring.high_water_bytes() / 1024 << " KiB";
+    if (ring.max_bytes() > 0) {
+        std::cout << " of " << ring.max_bytes() / 1024 << " KiB";
+    }
+    std::cout << std::endl << "    depth after push:";
+    for (int b = 0; b < ring.kDepthBuckets; b++) {
+        if (ring.depth_count(b) > 0) {
+            std::cout << " " << (1 << b);
+            if (b > 0) {
+                std::cout << "-" << (2 << b) - 1;
+            }
+            std::cout << ":" << ring.depth_count(b);
+        }
+    }
+    std::cout << std::endl;
+}
+
+template <typename T>
+uint64_t producer_wait_ns(const std::vector<std::unique_ptr<BatchQueue<T>>> &queues) {
+    uint64_t ns = 0;
+    for (auto& queue : queues) {
+        ns += queue->ring().producer_wait_ns();
+    }
+    return ns;
+}
+
+template <typename T>
+uint64_t consumer_wait_ns(const std::vector<std::unique_ptr<BatchQueue<T>>> &queues) {
+    uint64_t ns = 0;
+    for (auto& queue : queues) {
+        ns += queue->ring().consumer_wait_ns();
+    }
+    return ns;
+}
+
+// One line per stage: time spent working and blocked on either side, and how
+// fast the stage would run if it never had to wait. The stage with the most
+// busy time per thread is the bottleneck.
+void print_stage_report(const Pipeline &p) {
+    struct Row {
+        const StageStats &stats;
+        uint64_t wait_in_ns;
+        uint64_t wait_out_ns;
+    };
+    const Row rows[] = {
+        {p.demux_stats, 0, p.demuxed.ring().producer_wait_ns()},
+        {p.decode_stats, p.demuxed.ring().consumer_wait_ns(), producer_wait_ns(p.to_dsp)},
+        {p.dsp_stats, consumer_wait_ns(p.to_dsp), producer_wait_ns(p.from_dsp)},
+        {p.resample_stats, consumer_wait_ns(p.from_dsp), p.resampled.ring().producer_wait_ns()},
+        {p.encode_stats, p.resampled.ring().consumer_wait_ns(), p.encoded.ring().producer_wait_ns()},
+        {p.mux_stats, p.encoded.ring().consumer_wait_ns(), 0},
+    };
+
+    auto busy_per_thread = [](const Row &row) {
+        uint64_t active = row.stats.active_ns.load();
+        uint64_t waits = row.wait_in_ns + row.wait_out_ns;
+        return (active > waits ? active - waits : 0) / std::max(1, row.stats.threads.load());
+    };
+    const Row *bottleneck = &rows[0];
+    for (const Row &row : rows) {
+        if (busy_per_thread(row) > busy_per_thread(*bottleneck)) {
+            bottleneck = &row;
+        }
+    }
+
+    std::cout << "Stages (seconds summed over threads):" << std::endl << std::fixed << std::setprecision(3)
+              << "  stage     threads    busy  wait-in  wait-out      items     samples   max items/s" << std::endl;
+    for (const Row &row : rows) {
+        uint64_t busy = busy_per_thread(row);
+        int threads = std::max(1, row.stats.threads.load());
+        std::cout << "  " << std::left << std::setw(9) << row.stats.name << std::right << std::setw(8) << threads
+                  << std::setw(8) << busy * threads / 1e9 << std::setw(9) << row.wait_in_ns / 1e9
+                  << std::setw(10) << row.wait_out_ns / 1e9 << std::setw(11) << row.stats.items.load()
+                  << std::setw(12) << row.stats.samples.load() << std::setw(14) << std::setprecision(0)
+                  << (busy ? row.stats.items.load() * 1e9 / busy : 0.0) << std::setprecision(3)
+                  << (&row == bottleneck ? "  <- bottleneck" : "") << std::endl;
+    }
+
+    std::cout << "DSP effects (" << simd_kernels().name << " kernels):" << std::endl;
+    for (const StageStats *effect : {&p.gain_effect}) {
+        uint64_t samples = effect->samples.load();
+        std::cout << "  " << std::left << std::setw(9) << effect->name << std::right << std::setw(8)
+                  << effect->active_ns.load() / 1e9 << " s, " << effect->items.load() << " frames, "
+                  << std::setprecision(2) << (samples ? (double)effect->active_ns.load() / samples : 0.0)
+                  << " ns/sample" << std::setprecision(3) << std::endl;
+    }
+    std::cout << std::defaultfloat << std::setprecision(6);
+}
+
 int main(int argc, char *argv[]) {
 
 	auto start = std::chrono::high_resolution_clock::now();
 	
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <input_file> <output_file>" << std::endl;
+    PipelineConfig config;
+    config.affinity = affinity_policy_from_env(); // The command line overrides it
+    if (argc < 3 || !parse_pipeline_options(argc, argv, config)) {
+        std::cerr << "Usage: " << argv[0] << " <input_file> <output_file> [--packet-queue=N] [--frame-queue=N]"
+                  << " [--packet-queue-bytes=N[k|m]] [--frame-queue-bytes=N[k|m]] [--batch=N] [--batch-samples=N]"
+                  << " [--dsp-workers=N] [--affinity=none|compact|spread|numa]"
+                  << std::endl;
         return 1;
     }
 
+    if (config.dsp_workers == 0) {
+        int other_stages = 5;
+        config.dsp_workers = std::max(1, (int)std::thread::hardware_concurrency() - other_stages);
+    }
+
     const char* input_file = argv[1];
     const char* output_file = argv[2];
 
@@ -215,6 +595,11 @@ int main(int argc, char *argv[]) {
     encoder_ctx->sample_rate = decoder_ctx->sample_rate;
     encoder_ctx->ch_layout = decoder_ctx->ch_layout;
     encoder_ctx->bit_rate = 192000;
+    encoder_ctx->time_base = {1, decoder_ctx->sample_rate};
+
+    // Encoded payloads are recycled through the encode stage's packet pool
+    Pipeline pipeline(config);
+    pipeline.encoded_packets.attach_encoder(encoder_ctx);
 
     if (avcodec_open2(encoder_ctx, encoder, nullptr) < 0) {
         std::cerr << "Could not open encoder" << std::endl;
@@ -282,80 +667,73 @@ int main(int argc, char *argv[]) {
     av_opt_set_chlayout(swr_ctx, "out_chlayout", &encoder_ctx->ch_layout, 0);
     av_opt_set_int(swr_ctx, "out_sample_rate", encoder_ctx->sample_rate, 0);
     av_opt_set_sample_fmt(swr_ctx, "out_sample_fmt", encoder_ctx->sample_fmt, 0);
-    swr_init(swr_ctx);
-
-    AVPacket *input_packet = av_packet_alloc();
-    AVFrame *input_frame = av_frame_alloc();
-    AVFrame *resampled_frame = av_frame_alloc();
-    resampled_frame->nb_samples = encoder_ctx->frame_size;
-    resampled_frame->format = encoder_ctx->sample_fmt;
-    resampled_frame->ch_layout = encoder_ctx->ch_layout;
-    av_frame_get_buffer(resampled_frame, 0);
-
-    
-	
-	omp_set_num_threads(2); // Use 2 threads: 1 for decoding and 1 for encoding
-
-    #pragma omp parallel
-    {
-        if (omp_get_thread_num() == 0) {
-            // Producer: Read and decode frames
-            while (av_read_frame(input_format_ctx, input_packet) >= 0) {
-                if (input_packet->stream_index == audio_stream_index) {
-                    if (avcodec_send_packet(decoder_ctx, input_packet) < 0) {
-                        std::cerr << "Error submitting packet for decoding" << std::endl;
-                        break;
-                    }
-
-                    AVFrame* input_frame = av_frame_alloc();
-                    while (avcodec_receive_frame(decoder_ctx, input_frame) == 0) {
-                        // Process audio in its original format (optional)
-                        process_audio_frame(input_frame, decoder_ctx->sample_fmt);
-                        
-                        #pragma omp critical
-                       {
-                            std::lock_guard<std::mutex> lock(mtx);
-                            frame_queue.push(av_frame_clone(input_frame)); // Clone frame for safe access
-                        }
-                        cv.notify_one(); // Notify the encoder thread
-                    }
-                    av_frame_free(&input_frame);
-                }
-                av_packet_unref(input_packet);
-            }
+    if (swr_init(swr_ctx) < 0) {
+        std::cerr << "Could not initialize resampler" << std::endl;
+        swr_free(&swr_ctx);
+        avformat_free_context(output_format_ctx);
+        avcodec_free_context(&encoder_ctx);
+        avcodec_free_context(&decoder_ctx);
+        avformat_close_input(&input_format_ctx);
+        return 1;
+    }
 
-            // Signal that no more frames will be added
-            {
-                std::lock_guard<std::mutex> lock(mtx);
-                finished = true;
-            }
-            cv.notify_one(); // Notify the encoder thread to check for finished state
-        } else {
-            // Consumer: Encode and write frames
-            encoder_thread(encoder_ctx, output_format_ctx);
-        }
+    // One thread per stage, several for DSP, so throughput is bounded by the
+    // slowest stage rather than the sum of all of them
+    pipeline.input_format_ctx = input_format_ctx;
+    pipeline.audio_stream_index = audio_stream_index;
+    pipeline.decoder_ctx = decoder_ctx;
+    pipeline.swr_ctx = swr_ctx;
+    pipeline.encoder_ctx = encoder_ctx;
+    pipeline.output_format_ctx = output_format_ctx;
+
+    // Threads are placed in pipeline order, so with compact or numa placement
+    // neighbouring stages, which share frames, share a node
+    CpuPlacement placement(config.affinity, config.dsp_workers + 5);
+    if (config.affinity != AffinityPolicy::none) {
+        pipeline.prefill_frames = (int)config.frame_queue_depth + 2 * config.batch_items;
     }
-    
-    // Flush encoder
-    avcodec_send_frame(encoder_ctx, nullptr);
-    AVPacket *output_packet = av_packet_alloc();
-    while (avcodec_receive_packet(encoder_ctx, output_packet) == 0) {
-        output_packet->stream_index = 0;
-        av_packet_rescale_ts(output_packet, encoder_ctx->time_base, out_stream->time_base);
-        if (av_interleaved_write_frame(output_format_ctx, output_packet) < 0) {
-            std::cerr << "Error writing output packet during flushing" << std::endl;
-            break;
-        }
+    std::vector<std::thread> stages;
+    auto start_stage = [&](std::function<void()> stage) {
+        int slot = (int)stages.size();
+        stages.emplace_back([&placement, slot, stage] {
+            placement.pin_current_thread(slot);
+            stage();
+        });
+    };
+    start_stage([&] { demux_stage(pipeline); });
+    start_stage([&] { decode_stage(pipeline); });
+    for (int i = 0; i < config.dsp_workers; i++) {
+        start_stage([&, i] { dsp_stage(pipeline, i); });
+    }
+    start_stage([&] { resample_stage(pipeline); });
+    start_stage([&] { encode_stage(pipeline); });
+    start_stage([&] { mux_stage(pipeline); });
+    for (auto& stage : stages) {
+        stage.join();
     }
-    av_packet_free(&output_packet);
 
-    av_write_trailer(output_format_ctx);
+    bool succeeded = !pipeline.failed;
+    print_stage_report(pipeline);
+    std::cout << "Queue usage (batches of up to " << config.batch_items << " items";
+    if (config.batch_samples > 0) {
+        std::cout << " or " << config.batch_samples << " samples";
+    }
+    std::cout << "):" << std::endl;
+    print_queue_usage("demux -> decode", pipeline.demuxed);
+    for (int i = 0; i < config.dsp_workers; i++) {
+        std::string worker = std::to_string(i);
+        print_queue_usage(("decode -> dsp " + worker).c_str(), *pipeline.to_dsp[i]);
+        print_queue_usage(("dsp " + worker + " -> resample").c_str(), *pipeline.from_dsp[i]);
+    }
+    print_queue_usage("resample -> encode", pipeline.resampled);
+    print_queue_usage("encode -> mux", pipeline.encoded);
+    if (av_write_trailer(output_format_ctx) < 0) {
+        std::cerr << "Error writing output trailer" << std::endl;
+        succeeded = false;
+    }
 
     // Clean up
     swr_free(&swr_ctx);
-    av_frame_free(&input_frame);
-    av_frame_free(&resampled_frame);
-    av_packet_free(&input_packet);
     avcodec_free_context(&decoder_ctx);
     avcodec_free_context(&encoder_ctx);
     avformat_close_input(&input_format_ctx);
@@ -363,7 +741,13 @@ int main(int argc, char *argv[]) {
         avio_closep(&output_format_ctx->pb);
     avformat_free_context(output_format_ctx);
 
+    if (!succeeded) {
+        std::cerr << "Audio processing failed." << std::endl;
+        return 1;
+    }
     std::cout << "Audio processing completed successfully." << std::endl;
+    std::cout << "Frame pool: " << shared_frame_pool().allocated() << " frames allocated, "
+              << shared_frame_pool().reused() << " reused" << std::endl;
     
     auto end = std::chrono::high_resolution_clock::now();
 
@@ -13,6 +13,7 @@ extern "C" {
     #include <libavutil/channel_layout.h>
     #include <libavutil/samplefmt.h>
 }
+#include "PacketPool.h"
 
 // Process audio frame using OpenMP for parallel processing
 void process_audio_frame(AVFrame* frame, enum AVSampleFormat format) {
@@ -171,6 +172,10 @@ int main(int argc, char *argv[]) {
     encoder_ctx->ch_layout = decoder_ctx->ch_layout;
     encoder_ctx->bit_rate = 192000;
 
+    // Encoded payloads come from a recycled buffer pool instead of a fresh
+    // allocation per packet
+    PacketPool packet_pool;
+    packet_pool.attach_encoder(encoder_ctx);
     if (avcodec_open2(encoder_ctx, encoder, nullptr) < 0) {
         std::cerr << "Could not open encoder" << std::endl;
         avcodec_free_context(&encoder_ctx);
@@ -240,6 +245,7 @@ int main(int argc, char *argv[]) {
     swr_init(swr_ctx);
 
     AVPacket *input_packet = av_packet_alloc();
+    AVPacket *output_packet = av_packet_alloc(); // Reused for every encoded packet
     AVFrame *input_frame = av_frame_alloc();
     AVFrame *resampled_frame = av_frame_alloc();
     resampled_frame->nb_samples = encoder_ctx->frame_size;
@@ -273,7 +279,6 @@ int main(int argc, char *argv[]) {
                     break;
                 }
 
-                AVPacket *output_packet = av_packet_alloc();
                 while (avcodec_receive_packet(encoder_ctx, output_packet) == 0) {
                     output_packet->stream_index = 0;
                     av_packet_rescale_ts(output_packet, encoder_ctx->time_base, out_stream->time_base);
@@ -282,7 +287,6 @@ int main(int argc, char *argv[]) {
                         break;
                     }
                 }
-                av_packet_free(&output_packet);
             }
         }
         av_packet_unref(input_packet);
@@ -290,7 +294,6 @@ int main(int argc, char *argv[]) {
 
     // Flush encoder
     avcodec_send_frame(encoder_ctx, nullptr);
-    AVPacket *output_packet = av_packet_alloc();
     while (avcodec_receive_packet(encoder_ctx, output_packet) == 0) {
         output_packet->stream_index = 0;
         av_packet_rescale_ts(output_packet, encoder_ctx->time_base, out_stream->time_base);
@@ -299,7 +302,6 @@ int main(int argc, char *argv[]) {
             break;
         }
     }
-    av_packet_free(&output_packet);
 
     av_write_trailer(output_format_ctx);
 
@@ -308,6 +310,7 @@ int main(int argc, char *argv[]) {
     av_frame_free(&input_frame);
     av_frame_free(&resampled_frame);
     av_packet_free(&input_packet);
+    av_packet_free(&output_packet);
     avcodec_free_context(&decoder_ctx);
     avcodec_free_context(&encoder_ctx);
     avformat_close_input(&input_format_ctx);
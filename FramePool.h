@@ -0,0 +1,176 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+extern "C" {
+    #include <libavutil/frame.h>
+    #include <libavutil/channel_layout.h>
+    #include <libavutil/samplefmt.h>
+}
+
+// Recycles AVFrames so steady-state processing allocates nothing per frame.
+//
+// get() hands out a frame with sample buffers already allocated, taken from
+// the free list for its (format, channels, nb_samples); put() returns it. A
+// returned frame keeps its buffers only if the pool allocated them (marked by
+// frame->opaque) and nobody else holds a reference to them. Any other frame
+// is unreferenced, so decoder buffers go straight back to the decoder's own
+// buffer pool, and only the AVFrame shell is kept for get_empty(), which is
+// what avcodec_receive_frame() wants.
+//
+// All methods are thread-safe, so one pool can be shared by every stage and
+// pipeline in the process; see shared_frame_pool().
+class FramePool {
+public:
+    FramePool() = default;
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    ~FramePool() {
+        for (auto& entry : sized_) {
+            for (auto& frame : entry.second) {
+                av_frame_free(&frame);
+            }
+        }
+        for (auto& frame : empty_) {
+            av_frame_free(&frame);
+        }
+    }
+
+    // Frame with writable buffers for nb_samples samples. pts is reset, every
+    // other property is as requested. Returns nullptr if allocation fails.
+    AVFrame *get(enum AVSampleFormat format, const AVChannelLayout &layout, int sample_rate, int nb_samples) {
+        AVFrame *frame = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            auto it = sized_.find(key(format, layout.nb_channels, nb_samples));
+            if (it != sized_.end() && !it->second.empty()) {
+                frame = it->second.back();
+                it->second.pop_back();
+            }
+        }
+
+        if (frame) {
+            reused_.fetch_add(1, std::memory_order_relaxed);
+            if (av_channel_layout_compare(&frame->ch_layout, &layout) != 0) {
+                av_channel_layout_uninit(&frame->ch_layout);
+                av_channel_layout_copy(&frame->ch_layout, &layout);
+            }
+        } else if (!(frame = allocate(format, layout, nb_samples))) {
+            return nullptr;
+        }
+        frame->opaque = this;
+        frame->sample_rate = sample_rate;
+        frame->pts = AV_NOPTS_VALUE;
+        frame->duration = 0;
+        return frame;
+    }
+
+    // Allocates count frames as get() would and writes every page of their
+    // buffers from the calling thread, then keeps them. Under Linux's
+    // first-touch policy that puts the memory on the caller's NUMA node, so
+    // call it from the (pinned) thread that will fill these frames.
+    void prefill(enum AVSampleFormat format, const AVChannelLayout &layout, int nb_samples, int count) {
+        for (int i = 0; i < count; i++) {
+            AVFrame *frame = allocate(format, layout, nb_samples);
+            if (!frame) {
+                return;
+            }
+            for (int b = 0; b < AV_NUM_DATA_POINTERS && frame->buf[b]; b++) {
+                memset(frame->buf[b]->data, 0, frame->buf[b]->size);
+            }
+            for (int b = 0; b < frame->nb_extended_buf; b++) {
+                memset(frame->extended_buf[b]->data, 0, frame->extended_buf[b]->size);
+            }
+            frame->opaque = this;
+            put(frame);
+        }
+    }
+
+    // Frame without buffers, for decoders and av_frame_move_ref()
+    AVFrame *get_empty() {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (!empty_.empty()) {
+                AVFrame *frame = empty_.back();
+                empty_.pop_back();
+                reused_.fetch_add(1, std::memory_order_relaxed);
+                return frame;
+            }
+        }
+        allocated_.fetch_add(1, std::memory_order_relaxed);
+        return av_frame_alloc();
+    }
+
+    // Takes the frame back (nullptr is ignored)
+    void put(AVFrame *frame) {
+        if (!frame) {
+            return;
+        }
+
+        // Only our own, exclusively held buffers are worth keeping; anything
+        // that picked up side data or metadata is reset to a bare shell
+        bool keep_buffers = frame->opaque == this && frame->buf[0] && av_frame_is_writable(frame) &&
+                            frame->nb_side_data == 0 && !frame->metadata && !frame->opaque_ref;
+        if (!keep_buffers) {
+            av_frame_unref(frame);
+        }
+
+        std::lock_guard<std::mutex> lock(mtx_);
+        std::vector<AVFrame*> &list = keep_buffers
+            ? sized_[key((enum AVSampleFormat)frame->format, frame->ch_layout.nb_channels, frame->nb_samples)]
+            : empty_;
+        if (list.size() < kMaxFramesPerList) {
+            list.push_back(frame);
+            return;
+        }
+        av_frame_free(&frame);
+    }
+
+    // Frames created so far, and hand-outs served from the free lists
+    uint64_t allocated() const { return allocated_.load(std::memory_order_relaxed); }
+    uint64_t reused() const { return reused_.load(std::memory_order_relaxed); }
+
+private:
+    // More than any pipeline holds in flight; beyond this frames are freed
+    static const size_t kMaxFramesPerList = 1024;
+
+    AVFrame *allocate(enum AVSampleFormat format, const AVChannelLayout &layout, int nb_samples) {
+        allocated_.fetch_add(1, std::memory_order_relaxed);
+        AVFrame *frame = av_frame_alloc();
+        if (!frame) {
+            return nullptr;
+        }
+        frame->format = format;
+        frame->nb_samples = nb_samples;
+        av_channel_layout_copy(&frame->ch_layout, &layout);
+        if (av_frame_get_buffer(frame, 0) < 0) {
+            av_frame_free(&frame);
+            return nullptr;
+        }
+        return frame;
+    }
+
+    static uint64_t key(enum AVSampleFormat format, int channels, int nb_samples) {
+        return ((uint64_t)(uint16_t)format << 48) | ((uint64_t)(uint16_t)channels << 32) | (uint32_t)nb_samples;
+    }
+
+    std::mutex mtx_;
+    std::unordered_map<uint64_t, std::vector<AVFrame*>> sized_;
+    std::vector<AVFrame*> empty_;
+    std::atomic<uint64_t> allocated_{0};
+    std::atomic<uint64_t> reused_{0};
+};
+
+// The process-wide pool
+inline FramePool &shared_frame_pool() {
+    static FramePool pool;
+    return pool;
+}
+
+#endif
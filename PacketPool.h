@@ -0,0 +1,113 @@
+#ifndef PACKET_POOL_H
+#define PACKET_POOL_H
+
+#include <cstring>
+#include <vector>
+extern "C" {
+    #include <libavcodec/avcodec.h>
+    #include <libavutil/buffer.h>
+}
+#include "SpscRing.h"
+
+// Reusable AVPackets owned by one stage.
+//
+// The owning thread takes packets with get() and recycles them with put().
+// When packets travel to the next stage, that stage (and only that one)
+// returns them with give_back(), which unreferences the payload and hands the
+// shell back through an SPSC ring the owner drains in get(). Nothing here
+// takes a lock.
+//
+// attach_encoder() additionally makes an encoder write its output into
+// payload buffers from an AVBufferPool, so encoded payloads are recycled too
+// once the muxer (or whoever holds the last reference) lets go of them.
+class PacketPool {
+public:
+    // Payloads up to this size come from the pool, anything larger falls
+    // back to libavcodec's default allocation. Fits any MP3 frame.
+    static const int kDefaultPayloadSize = 16 * 1024;
+
+    explicit PacketPool(size_t return_capacity = 64, int payload_size = kDefaultPayloadSize)
+        : returned_(return_capacity), payload_size_(payload_size) {}
+
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    ~PacketPool() {
+        AVPacket *packet;
+        while (returned_.try_pop(packet)) {
+            free_.push_back(packet);
+        }
+        for (auto& packet : free_) {
+            av_packet_free(&packet);
+        }
+        av_buffer_pool_uninit(&payloads_); // Buffers still out are freed as they come back
+    }
+
+    // Owner thread: a blank packet
+    AVPacket *get() {
+        AVPacket *packet;
+        if (returned_.try_pop(packet)) {
+            return packet;
+        }
+        if (!free_.empty()) {
+            packet = free_.back();
+            free_.pop_back();
+            return packet;
+        }
+        return av_packet_alloc();
+    }
+
+    // Owner thread: recycle a packet (nullptr is ignored)
+    void put(AVPacket *packet) {
+        if (packet) {
+            av_packet_unref(packet);
+            free_.push_back(packet);
+        }
+    }
+
+    // Downstream thread: return a packet that came from get()
+    void give_back(AVPacket *packet) {
+        av_packet_unref(packet);
+        if (!returned_.try_push(packet)) {
+            av_packet_free(&packet); // Owner is behind on draining; not worth blocking for
+        }
+    }
+
+    // Route the encoder's output payloads through this pool. Uses
+    // enc_ctx->opaque, so the pool must outlive the encoder. Encoders that do
+    // not support custom output buffers are left alone.
+    void attach_encoder(AVCodecContext *enc_ctx) {
+        if (!enc_ctx->codec || !(enc_ctx->codec->capabilities & AV_CODEC_CAP_DR1)) {
+            return;
+        }
+        if (!payloads_) {
+            payloads_ = av_buffer_pool_init(payload_size_ + AV_INPUT_BUFFER_PADDING_SIZE, nullptr);
+        }
+        if (payloads_) {
+            enc_ctx->opaque = this;
+            enc_ctx->get_encode_buffer = get_encode_buffer;
+        }
+    }
+
+private:
+    static int get_encode_buffer(AVCodecContext *enc_ctx, AVPacket *packet, int flags) {
+        PacketPool *pool = static_cast<PacketPool*>(enc_ctx->opaque);
+        if (packet->size > pool->payload_size_) {
+            return avcodec_default_get_encode_buffer(enc_ctx, packet, flags);
+        }
+        packet->buf = av_buffer_pool_get(pool->payloads_);
+        if (!packet->buf) {
+            return AVERROR(ENOMEM);
+        }
+        packet->data = packet->buf->data;
+        memset(packet->data + packet->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        return 0;
+    }
+
+    SpscRing<AVPacket*> returned_;
+    std::vector<AVPacket*> free_;
+    AVBufferPool *payloads_ = nullptr;
+    int payload_size_;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef REVERB_H
+#define REVERB_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Algorithmic room reverb after Schroeder, with the tuning of Jezar's
+// Freeverb: per channel, eight damped feedback comb filters in parallel
+// followed by four all-pass filters in series.
+//
+// Every filter is a ring-buffer delay line that lives in the Reverb and keeps
+// running from one frame to the next, so tails ring on across frame
+// boundaries; one Reverb serves one stream. Channels share nothing, so
+// process_channel() may run for different channels on different threads at
+// once. Each channel's delay lengths are offset a little (the stereo spread)
+// so channels decorrelate.
+
+class Reverb {
+public:
+    // Samples per channel processed per step, one delay line at a time
+    static constexpr int kBlock = 256;
+
+    Reverb() = default;
+
+    // room_size in [0, 1] sets the comb feedback (tail length), damping in
+    // [0, 1] how fast highs die away. Clears all delay lines.
+    void configure(int channels, int sample_rate, float room_size = 0.5f, float damping = 0.5f) {
+        // Freeverb's delay lengths, in samples at 44.1 kHz
+        const int comb_lengths[kCombs] = {1116, 1188, 1277, 1356, 1422, 1491, 1557, 1617};
+        const int allpass_lengths[kAllpasses] = {556, 441, 341, 225};
+        const int spread = 23;
+
+        channels_ = channels;
+        sample_rate_ = sample_rate;
+        feedback_ = room_size * 0.28f + 0.7f;
+        damping_ = damping * 0.4f;
+        double scale = sample_rate / 44100.0;
+        lines_.assign(channels, Channel());
+        for (int ch = 0; ch < channels; ch++) {
+            for (int c = 0; c < kCombs; c++) {
+                lines_[ch].combs[c].buffer.assign(std::max(1, (int)((comb_lengths[c] + ch * spread) * scale)), 0.0f);
+            }
+            for (int a = 0; a < kAllpasses; a++) {
+                lines_[ch].allpasses[a].buffer.assign(std::max(1, (int)((allpass_lengths[a] + ch * spread) * scale)), 0.0f);
+            }
+        }
+    }
+
+    bool configured_for(int sample_rate, int channels) const {
+        return !lines_.empty() && sample_rate_ == sample_rate && channels_ == channels;
+    }
+
+    int channels() const { return channels_; }
+
+    // out = dry * in + wet * reverb(in) for one channel, in place through a
+    // SampleAccess (see SampleFormat.h), clamped to full scale
+    template <typename Access>
+    void process_channel(Access samples, int ch, int nb_samples, float dry, float wet) {
+        Channel &line = lines_[ch];
+        auto *data = samples.channel(ch);
+        const ptrdiff_t step = samples.step();
+        float in[kBlock], out[kBlock];
+        for (int start = 0; start < nb_samples; start += kBlock) {
+            int n = std::min(kBlock, nb_samples - start);
+            for (int i = 0; i < n; i++) {
+                // The tiny offset keeps decaying tails out of denormal range,
+                // which is very slow on x86
+                in[i] = Access::read(data[(start + i) * step]) * kInputGain + kAntiDenormal;
+                out[i] = 0.0f;
+            }
+            for (Comb &comb : line.combs) {
+                run_comb(comb, in, out, n);
+            }
+            for (Allpass &allpass : line.allpasses) {
+                run_allpass(allpass, out, n);
+            }
+            for (int i = 0; i < n; i++) {
+                auto &sample = data[(start + i) * step];
+                float x = Access::read(sample);
+                sample = Access::write(std::clamp(dry * x + wet * kWetScale * out[i], -1.0f, 1.0f));
+            }
+        }
+    }
+
+    template <typename Access>
+    void process(Access samples, int nb_samples, float dry, float wet) {
+        for (int ch = 0; ch < channels_; ch++) {
+            process_channel(samples, ch, nb_samples, dry, wet);
+        }
+    }
+
+private:
+    static constexpr int kCombs = 8;
+    static constexpr int kAllpasses = 4;
+    static constexpr float kInputGain = 0.015f;
+    static constexpr float kWetScale = 3.0f;
+    static constexpr float kAllpassFeedback = 0.5f;
+    static constexpr float kAntiDenormal = 1e-18f;
+
+    struct Comb {
+        std::vector<float> buffer;
+        size_t pos = 0;
+        float filtered = 0.0f; // One-pole low-pass state in the feedback path
+    };
+
+    struct Allpass {
+        std::vector<float> buffer;
+        size_t pos = 0;
+    };
+
+    struct Channel {
+        Comb combs[kCombs];
+        Allpass allpasses[kAllpasses];
+    };
+
+    // Feedback comb with a low-pass in the loop; adds its output to out
+    void run_comb(Comb &comb, const float *in, float *out, int n) const {
+        float *buffer = comb.buffer.data();
+        size_t size = comb.buffer.size(), pos = comb.pos;
+        float filtered = comb.filtered;
+        for (int i = 0; i < n; i++) {
+            float delayed = buffer[pos];
+            filtered = delayed * (1.0f - damping_) + filtered * damping_;
+            buffer[pos] = in[i] + filtered * feedback_;
+            out[i] += delayed;
+            if (++pos == size) {
+                pos = 0;
+            }
+        }
+        comb.pos = pos;
+        comb.filtered = filtered;
+    }
+
+    static void run_allpass(Allpass &allpass, float *x, int n) {
+        float *buffer = allpass.buffer.data();
+        size_t size = allpass.buffer.size(), pos = allpass.pos;
+        for (int i = 0; i < n; i++) {
+            float delayed = buffer[pos];
+            buffer[pos] = x[i] + delayed * kAllpassFeedback;
+            x[i] = delayed - x[i];
+            if (++pos == size) {
+                pos = 0;
+            }
+        }
+        allpass.pos = pos;
+    }
+
+    int channels_ = 0;
+    int sample_rate_ = 0;
+    float feedback_ = 0.0f;
+    float damping_ = 0.0f;
+    std::vector<Channel> lines_;
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef SAMPLE_FORMAT_H
+#define SAMPLE_FORMAT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+extern "C" {
+    #include <libavutil/frame.h>
+    #include <libavutil/samplefmt.h>
+}
+
+// Sample-type traits and a once-per-frame format dispatch for the DSP
+// effects.
+//
+// Effects are written once as generic code over a SampleAccess and work on
+// normalized float (full scale is [-1, 1] for every format).
+// visit_samples() looks at the frame's format once and calls the effect with
+// the matching SampleAccess type. The per-sample loads and stores then
+// compile to a fixed conversion with no branch on the format, and the inner
+// loops can be vectorized.
+//
+// Loops walk memory in order: a planar frame one plane at a time, a packed
+// frame straight through its single interleaved plane. Point-wise effects
+// use plane()/plane_size() (or map_samples()), which covers both; effects
+// that look along a channel (delays, windows) go channel by channel with
+// channel()/step().
+
+template <typename T>
+struct SampleTraits;
+
+template <>
+struct SampleTraits<float> {
+    static float to_float(float sample) { return sample; }
+    static float from_float(float value) { return value; } // Float keeps headroom; effects clamp where they mean to
+};
+
+template <>
+struct SampleTraits<int16_t> {
+    static float to_float(int16_t sample) { return sample * (1.0f / 32768.0f); }
+    static int16_t from_float(float value) { return (int16_t)std::clamp(value * 32768.0f, -32768.0f, 32767.0f); }
+};
+
+template <>
+struct SampleTraits<int32_t> {
+    static float to_float(int32_t sample) { return sample * (1.0f / 2147483648.0f); }
+    static int32_t from_float(float value) {
+        // 2147483520 is the largest float below 2^31
+        return (int32_t)std::clamp(value * 2147483648.0f, -2147483648.0f, 2147483520.0f);
+    }
+};
+
+// Typed view of a frame's samples. Planar frames keep one plane per channel;
+// packed frames interleave all channels in plane 0, so a channel's samples
+// are step() apart.
+template <typename T, bool Planar>
+struct SampleAccess {
+    using Sample = T;
+    static constexpr bool planar = Planar;
+
+    uint8_t *const *data;
+    int channels;
+
+    T *channel(int ch) const { return Planar ? (T*)data[ch] : (T*)data[0] + ch; }
+    ptrdiff_t step() const { return Planar ? 1 : channels; }
+
+    float load(int ch, int i) const { return SampleTraits<T>::to_float(channel(ch)[i * step()]); }
+    void store(int ch, int i, float value) const { channel(ch)[i * step()] = SampleTraits<T>::from_float(value); }
+
+    // Contiguous runs of samples: one per channel if planar, else one run
+    // holding every channel
+    int planes() const { return Planar ? channels : 1; }
+    T *plane(int p) const { return (T*)data[p]; }
+    int plane_size(int nb_samples) const { return Planar ? nb_samples : nb_samples * channels; }
+
+    static float read(T sample) { return SampleTraits<T>::to_float(sample); }
+    static T write(float value) { return SampleTraits<T>::from_float(value); }
+};
+
+// Applies fn(float) -> float to every sample, plane by plane
+template <typename Access, typename Fn>
+void map_samples(Access samples, int nb_samples, Fn fn) {
+    for (int p = 0; p < samples.planes(); p++) {
+        auto *data = samples.plane(p);
+        int size = samples.plane_size(nb_samples);
+        for (int i = 0; i < size; i++) {
+            data[i] = Access::write(fn(Access::read(data[i])));
+        }
+    }
+}
+
+// Calls fn(SampleAccess<T, Planar>) for the frame's sample format. Returns
+// false, without calling fn, for formats the effects do not handle (double,
+// 64-bit and unsigned 8-bit samples).
+template <typename Fn>
+bool visit_samples(AVFrame *frame, enum AVSampleFormat format, Fn &&fn) {
+    uint8_t *const *data = frame->extended_data;
+    int channels = frame->ch_layout.nb_channels;
+    switch (format) {
+        case AV_SAMPLE_FMT_FLT:
+            fn(SampleAccess<float, false>{data, channels});
+            return true;
+        case AV_SAMPLE_FMT_FLTP:
+            fn(SampleAccess<float, true>{data, channels});
+            return true;
+        case AV_SAMPLE_FMT_S16:
+            fn(SampleAccess<int16_t, false>{data, channels});
+            return true;
+        case AV_SAMPLE_FMT_S16P:
+            fn(SampleAccess<int16_t, true>{data, channels});
+            return true;
+        case AV_SAMPLE_FMT_S32:
+            fn(SampleAccess<int32_t, false>{data, channels});
+            return true;
+        case AV_SAMPLE_FMT_S32P:
+            fn(SampleAccess<int32_t, true>{data, channels});
+            return true;
+        default:
+            return false;
+    }
+}
+
+#endif
@@ -0,0 +1,428 @@
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_KERNELS_X86 1
+#endif
+
+// Hand-vectorized inner loops for the point-wise effects and for sample
+// conversion, in scalar, SSE2, AVX2 and AVX-512 versions.
+//
+// Every version is compiled into the binary (through target attributes, not
+// -m flags), and simd_kernels() picks the widest one the CPU supports the
+// first time it is called, so one build runs well across machine
+// generations. PARALLEL_FFMPEG_SIMD=scalar|sse2|avx2|avx512 caps the choice,
+// which is handy for comparing them.
+//
+// Samples are normalized float. Conversion matches SampleTraits: integers
+// scale by 2^15 or 2^31 and convert back with truncation and saturation.
+
+enum class SimdLevel { scalar, sse2, avx2, avx512 };
+
+struct SimdKernels {
+    const char *name;
+    // data[i] = clamp(data[i] * gain, lo, hi)
+    void (*gain_clamp)(float *data, int n, float gain, float lo, float hi);
+    // Above threshold: threshold + (x - threshold) / ratio; then clamp to [-1, 1]
+    void (*compress_clamp)(float *data, int n, float threshold, float ratio);
+    void (*s16_to_float)(const int16_t *in, float *out, int n);
+    void (*float_to_s16)(const float *in, int16_t *out, int n);
+    void (*s32_to_float)(const int32_t *in, float *out, int n);
+    void (*float_to_s32)(const float *in, int32_t *out, int n);
+};
+
+// Scalar versions, also used for the tails of the vector loops
+
+static inline void scalar_gain_clamp(float *data, int n, float gain, float lo, float hi) {
+    for (int i = 0; i < n; i++) {
+        data[i] = std::clamp(data[i] * gain, lo, hi);
+    }
+}
+
+static inline void scalar_compress_clamp(float *data, int n, float threshold, float ratio) {
+    float inv_ratio = 1.0f / ratio;
+    for (int i = 0; i < n; i++) {
+        float x = data[i];
+        if (std::abs(x) > threshold) {
+            x = threshold + (x - threshold) * inv_ratio;
+        }
+        data[i] = std::clamp(x, -1.0f, 1.0f);
+    }
+}
+
+static inline void scalar_s16_to_float(const int16_t *in, float *out, int n) {
+    for (int i = 0; i < n; i++) {
+        out[i] = in[i] * (1.0f / 32768.0f);
+    }
+}
+
+static inline void scalar_float_to_s16(const float *in, int16_t *out, int n) {
+    for (int i = 0; i < n; i++) {
+        out[i] = (int16_t)std::clamp(in[i] * 32768.0f, -32768.0f, 32767.0f);
+    }
+}
+
+static inline void scalar_s32_to_float(const int32_t *in, float *out, int n) {
+    for (int i = 0; i < n; i++) {
+        out[i] = in[i] * (1.0f / 2147483648.0f);
+    }
+}
+
+static inline void scalar_float_to_s32(const float *in, int32_t *out, int n) {
+    for (int i = 0; i < n; i++) {
+        out[i] = (int32_t)std::clamp(in[i] * 2147483648.0f, -2147483648.0f, 2147483520.0f);
+    }
+}
+
+#ifdef SIMD_KERNELS_X86
+
+// SSE2: 4 floats per step
+
+__attribute__((target("sse2")))
+static void sse2_gain_clamp(float *data, int n, float gain, float lo, float hi) {
+    __m128 g = _mm_set1_ps(gain), vlo = _mm_set1_ps(lo), vhi = _mm_set1_ps(hi);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(data + i), g);
+        _mm_storeu_ps(data + i, _mm_min_ps(_mm_max_ps(x, vlo), vhi));
+    }
+    scalar_gain_clamp(data + i, n - i, gain, lo, hi);
+}
+
+__attribute__((target("sse2")))
+static void sse2_compress_clamp(float *data, int n, float threshold, float ratio) {
+    __m128 t = _mm_set1_ps(threshold), inv = _mm_set1_ps(1.0f / ratio);
+    __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 one = _mm_set1_ps(1.0f), minus_one = _mm_set1_ps(-1.0f);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(data + i);
+        __m128 over = _mm_cmpgt_ps(_mm_and_ps(x, abs_mask), t);
+        __m128 y = _mm_add_ps(t, _mm_mul_ps(_mm_sub_ps(x, t), inv));
+        x = _mm_or_ps(_mm_and_ps(over, y), _mm_andnot_ps(over, x));
+        _mm_storeu_ps(data + i, _mm_min_ps(_mm_max_ps(x, minus_one), one));
+    }
+    scalar_compress_clamp(data + i, n - i, threshold, ratio);
+}
+
+__attribute__((target("sse2")))
+static void sse2_s16_to_float(const int16_t *in, float *out, int n) {
+    __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16); // Sign-extend
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    scalar_s16_to_float(in + i, out + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void sse2_float_to_s16(const float *in, int16_t *out, int n) {
+    __m128 scale = _mm_set1_ps(32768.0f), lo = _mm_set1_ps(-32768.0f), hi = _mm_set1_ps(32767.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), lo), hi);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), lo), hi);
+        __m128i packed = _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b));
+        _mm_storeu_si128((__m128i*)(out + i), packed);
+    }
+    scalar_float_to_s16(in + i, out + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void sse2_s32_to_float(const int32_t *in, float *out, int n) {
+    __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+    scalar_s32_to_float(in + i, out + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void sse2_float_to_s32(const float *in, int32_t *out, int n) {
+    __m128 scale = _mm_set1_ps(2147483648.0f), lo = _mm_set1_ps(-2147483648.0f), hi = _mm_set1_ps(2147483520.0f);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), lo), hi);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_cvttps_epi32(x));
+    }
+    scalar_float_to_s32(in + i, out + i, n - i);
+}
+
+// AVX2: 8 floats per step
+
+__attribute__((target("avx2")))
+static void avx2_gain_clamp(float *data, int n, float gain, float lo, float hi) {
+    __m256 g = _mm256_set1_ps(gain), vlo = _mm256_set1_ps(lo), vhi = _mm256_set1_ps(hi);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_mul_ps(_mm256_loadu_ps(data + i), g);
+        _mm256_storeu_ps(data + i, _mm256_min_ps(_mm256_max_ps(x, vlo), vhi));
+    }
+    scalar_gain_clamp(data + i, n - i, gain, lo, hi);
+}
+
+__attribute__((target("avx2")))
+static void avx2_compress_clamp(float *data, int n, float threshold, float ratio) {
+    __m256 t = _mm256_set1_ps(threshold), inv = _mm256_set1_ps(1.0f / ratio);
+    __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 one = _mm256_set1_ps(1.0f), minus_one = _mm256_set1_ps(-1.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps(data + i);
+        __m256 over = _mm256_cmp_ps(_mm256_and_ps(x, abs_mask), t, _CMP_GT_OQ);
+        __m256 y = _mm256_add_ps(t, _mm256_mul_ps(_mm256_sub_ps(x, t), inv));
+        x = _mm256_blendv_ps(x, y, over);
+        _mm256_storeu_ps(data + i, _mm256_min_ps(_mm256_max_ps(x, minus_one), one));
+    }
+    scalar_compress_clamp(data + i, n - i, threshold, ratio);
+}
+
+__attribute__((target("avx2")))
+static void avx2_s16_to_float(const int16_t *in, float *out, int n) {
+    __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    scalar_s16_to_float(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_float_to_s16(const float *in, int16_t *out, int n) {
+    __m256 scale = _mm256_set1_ps(32768.0f), lo = _mm256_set1_ps(-32768.0f), hi = _mm256_set1_ps(32767.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale), lo), hi);
+        __m256i v = _mm256_cvttps_epi32(x);
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        _mm_storeu_si128((__m128i*)(out + i), packed);
+    }
+    scalar_float_to_s16(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_s32_to_float(const int32_t *in, float *out, int n) {
+    __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    scalar_s32_to_float(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_float_to_s32(const float *in, int32_t *out, int n) {
+    __m256 scale = _mm256_set1_ps(2147483648.0f);
+    __m256 lo = _mm256_set1_ps(-2147483648.0f), hi = _mm256_set1_ps(2147483520.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale), lo), hi);
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_cvttps_epi32(x));
+    }
+    scalar_float_to_s32(in + i, out + i, n - i);
+}
+
+// AVX-512 (foundation subset only): 16 floats per step. GCC 12's headers
+// trip -Wmaybe-uninitialized on their own undefined-vector placeholders.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+static void avx512_gain_clamp(float *data, int n, float gain, float lo, float hi) {
+    __m512 g = _mm512_set1_ps(gain), vlo = _mm512_set1_ps(lo), vhi = _mm512_set1_ps(hi);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 x = _mm512_mul_ps(_mm512_loadu_ps(data + i), g);
+        _mm512_storeu_ps(data + i, _mm512_min_ps(_mm512_max_ps(x, vlo), vhi));
+    }
+    scalar_gain_clamp(data + i, n - i, gain, lo, hi);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_compress_clamp(float *data, int n, float threshold, float ratio) {
+    __m512 t = _mm512_set1_ps(threshold), inv = _mm512_set1_ps(1.0f / ratio);
+    __m512i abs_mask = _mm512_set1_epi32(0x7fffffff);
+    __m512 one = _mm512_set1_ps(1.0f), minus_one = _mm512_set1_ps(-1.0f);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 x = _mm512_loadu_ps(data + i);
+        __m512 abs_x = _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(x), abs_mask));
+        __mmask16 over = _mm512_cmp_ps_mask(abs_x, t, _CMP_GT_OQ);
+        __m512 y = _mm512_add_ps(t, _mm512_mul_ps(_mm512_sub_ps(x, t), inv));
+        x = _mm512_mask_blend_ps(over, x, y);
+        _mm512_storeu_ps(data + i, _mm512_min_ps(_mm512_max_ps(x, minus_one), one));
+    }
+    scalar_compress_clamp(data + i, n - i, threshold, ratio);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_s16_to_float(const int16_t *in, float *out, int n) {
+    __m512 scale = _mm512_set1_ps(1.0f / 32768.0f);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i v = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)(in + i)));
+        _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_cvtepi32_ps(v), scale));
+    }
+    scalar_s16_to_float(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_float_to_s16(const float *in, int16_t *out, int n) {
+    __m512 scale = _mm512_set1_ps(32768.0f), lo = _mm512_set1_ps(-32768.0f), hi = _mm512_set1_ps(32767.0f);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 x = _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(_mm512_loadu_ps(in + i), scale), lo), hi);
+        _mm256_storeu_si256((__m256i*)(out + i), _mm512_cvtsepi32_epi16(_mm512_cvttps_epi32(x)));
+    }
+    scalar_float_to_s16(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_s32_to_float(const int32_t *in, float *out, int n) {
+    __m512 scale = _mm512_set1_ps(1.0f / 2147483648.0f);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i v = _mm512_loadu_si512((const void*)(in + i));
+        _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_cvtepi32_ps(v), scale));
+    }
+    scalar_s32_to_float(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_float_to_s32(const float *in, int32_t *out, int n) {
+    __m512 scale = _mm512_set1_ps(2147483648.0f);
+    __m512 lo = _mm512_set1_ps(-2147483648.0f), hi = _mm512_set1_ps(2147483520.0f);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 x = _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(_mm512_loadu_ps(in + i), scale), lo), hi);
+        _mm512_storeu_si512((void*)(out + i), _mm512_cvttps_epi32(x));
+    }
+    scalar_float_to_s32(in + i, out + i, n - i);
+}
+
+#pragma GCC diagnostic pop
+
+#endif // SIMD_KERNELS_X86
+
+// Whether this CPU (and OS) can run the given level
+inline bool simd_level_supported(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::scalar:
+            return true;
+#ifdef SIMD_KERNELS_X86
+        case SimdLevel::sse2:
+            return __builtin_cpu_supports("sse2");
+        case SimdLevel::avx2:
+            return __builtin_cpu_supports("avx2");
+        case SimdLevel::avx512:
+            return __builtin_cpu_supports("avx512f");
+#endif
+        default:
+            return false;
+    }
+}
+
+// Kernels of one level; the caller checks simd_level_supported() first
+inline const SimdKernels &simd_kernels_for(SimdLevel level) {
+    static const SimdKernels scalar = {"scalar", scalar_gain_clamp, scalar_compress_clamp, scalar_s16_to_float,
+                                       scalar_float_to_s16, scalar_s32_to_float, scalar_float_to_s32};
+#ifdef SIMD_KERNELS_X86
+    static const SimdKernels sse2 = {"sse2", sse2_gain_clamp, sse2_compress_clamp, sse2_s16_to_float,
+                                     sse2_float_to_s16, sse2_s32_to_float, sse2_float_to_s32};
+    static const SimdKernels avx2 = {"avx2", avx2_gain_clamp, avx2_compress_clamp, avx2_s16_to_float,
+                                     avx2_float_to_s16, avx2_s32_to_float, avx2_float_to_s32};
+    static const SimdKernels avx512 = {"avx512", avx512_gain_clamp, avx512_compress_clamp, avx512_s16_to_float,
+                                       avx512_float_to_s16, avx512_s32_to_float, avx512_float_to_s32};
+    switch (level) {
+        case SimdLevel::sse2:
+            return sse2;
+        case SimdLevel::avx2:
+            return avx2;
+        case SimdLevel::avx512:
+            return avx512;
+        default:
+            break;
+    }
+#endif
+    (void)level;
+    return scalar;
+}
+
+// The widest supported level, capped by PARALLEL_FFMPEG_SIMD if set
+inline SimdLevel simd_best_level() {
+    SimdLevel cap = SimdLevel::avx512;
+    const char *env = getenv("PARALLEL_FFMPEG_SIMD");
+    if (env) {
+        const struct { const char *name; SimdLevel level; } names[] = {
+            {"scalar", SimdLevel::scalar}, {"sse2", SimdLevel::sse2},
+            {"avx2", SimdLevel::avx2}, {"avx512", SimdLevel::avx512},
+        };
+        for (const auto& entry : names) {
+            if (strcmp(env, entry.name) == 0) {
+                cap = entry.level;
+            }
+        }
+    }
+    for (SimdLevel level : {SimdLevel::avx512, SimdLevel::avx2, SimdLevel::sse2}) {
+        if (level <= cap && simd_level_supported(level)) {
+            return level;
+        }
+    }
+    return SimdLevel::scalar;
+}
+
+// The kernels for this machine, chosen once
+inline const SimdKernels &simd_kernels() {
+    static const SimdKernels &kernels = simd_kernels_for(simd_best_level());
+    return kernels;
+}
+
+// Samples processed per simd_map_block() call; integer samples are staged
+// through a float buffer of this size on the stack
+const int kSimdBlock = 256;
+
+// Runs fn(float *samples, int n) over up to kSimdBlock samples of any
+// sample type, converting integer samples to float and back around it
+template <typename T, typename Fn>
+void simd_map_block(T *data, int n, Fn fn) {
+    if constexpr (std::is_same<T, float>::value) {
+        fn(data, n);
+    } else {
+        static_assert(std::is_same<T, int16_t>::value || std::is_same<T, int32_t>::value, "unsupported sample type");
+        const SimdKernels &k = simd_kernels();
+        float block[kSimdBlock];
+        if constexpr (std::is_same<T, int16_t>::value) {
+            k.s16_to_float(data, block, n);
+            fn(block, n);
+            k.float_to_s16(block, data, n);
+        } else {
+            k.s32_to_float(data, block, n);
+            fn(block, n);
+            k.float_to_s32(block, data, n);
+        }
+    }
+}
+
+// simd_map_block() over a whole run of samples
+template <typename T, typename Fn>
+void simd_map(T *data, int n, Fn fn) {
+    for (int start = 0; start < n; start += kSimdBlock) {
+        simd_map_block(data + start, std::min(kSimdBlock, n - start), fn);
+    }
+}
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef SLIDING_WINDOW_H
+#define SLIDING_WINDOW_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include "SimdKernels.h"
+
+// Centred moving averages over a stream, computed with running sums so the
+// cost per sample does not depend on the window width.
+//
+// Each output is the weighted mean of the input samples within half_window of
+// it, taken from the input as it was (the filter never reads its own
+// output). A centred window needs half_window samples of look-ahead, so
+// output comes half_window samples late; the last 2 * half_window input
+// samples of every channel are kept from one frame to the next, so windows
+// run straight across frame boundaries. The stream starts from silence, and
+// flush() runs it out into silence at the end.
+//
+// Kernels:
+//   boxcar       equal weights. One running sum per channel, carried across
+//                frames: each step adds the sample entering and drops the one
+//                leaving. Those differences are independent, so the SSE2 and
+//                AVX2 versions take them 4 at a time and add them up with an
+//                in-register prefix sum, leaving one dependent add per 4
+//                samples. Sums are kept in double so they cannot drift.
+//   exponential  weight r^|j| at distance j, r = e^(-1 / half_window). With
+//                E[k] = x[k] + r E[k-1] running forwards and S[k] = x[k] +
+//                r S[k+1] backwards, the window sum around c is
+//                E[c] - r^(h+1) E[c-h-1] + S[c] - r^(h+1) S[c+h+1] - x[c].
+//                Both recursions restart each frame over the frame plus the
+//                carried samples, so nothing drifts.
+//
+// Channels keep separate state, so process_channel() may run for different
+// channels on different threads at once. One SlidingWindow serves one stream.
+
+// Boxcar window sums over one channel: x holds carried samples of history
+// followed by the n new ones, *sum enters as the sum of the history and
+// leaves as the sum of the last carried samples. out[i] = norm * the sum of
+// x[i .. i + carried].
+static inline void boxcar_sums_scalar(const float *x, int carried, int n, double *sum, float norm, float *out) {
+    double running = *sum;
+    for (int i = 0; i < n; i++) {
+        running += x[carried + i];
+        out[i] = (float)running * norm;
+        running -= x[i];
+    }
+    *sum = running;
+}
+
+#ifdef SIMD_KERNELS_X86
+
+// Running sum r[i] = sum + (x[c] - x[0]) + ... + (x[c+i] - x[i]), and
+// out[i] = r[i] + x[i] (the window before the sample leaving is dropped)
+__attribute__((target("sse2")))
+static void boxcar_sums_sse2(const float *x, int carried, int n, double *sum, float norm, float *out) {
+    __m128d carry = _mm_set1_pd(*sum);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 entering = _mm_loadu_ps(x + carried + i), leaving = _mm_loadu_ps(x + i);
+        __m128d leave_a = _mm_cvtps_pd(leaving), leave_b = _mm_cvtps_pd(_mm_movehl_ps(leaving, leaving));
+        __m128d a = _mm_sub_pd(_mm_cvtps_pd(entering), leave_a);
+        __m128d b = _mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(entering, entering)), leave_b);
+        // Prefix sums within each pair, then b on top of a
+        a = _mm_add_pd(a, _mm_unpacklo_pd(_mm_setzero_pd(), a));
+        b = _mm_add_pd(b, _mm_unpacklo_pd(_mm_setzero_pd(), b));
+        b = _mm_add_pd(b, _mm_unpackhi_pd(a, a));
+        __m128 lo = _mm_cvtpd_ps(_mm_add_pd(_mm_add_pd(a, carry), leave_a));
+        __m128 hi = _mm_cvtpd_ps(_mm_add_pd(_mm_add_pd(b, carry), leave_b));
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_movelh_ps(lo, hi), _mm_set1_ps(norm)));
+        carry = _mm_add_pd(carry, _mm_unpackhi_pd(b, b));
+    }
+    *sum = _mm_cvtsd_f64(carry);
+    boxcar_sums_scalar(x + i, carried, n - i, sum, norm, out + i);
+}
+
+__attribute__((target("avx2")))
+static void boxcar_sums_avx2(const float *x, int carried, int n, double *sum, float norm, float *out) {
+    __m256d carry = _mm256_set1_pd(*sum), zero = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256d leave_a = _mm256_cvtps_pd(_mm_loadu_ps(x + i)), leave_b = _mm256_cvtps_pd(_mm_loadu_ps(x + i + 4));
+        __m256d a = _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(x + carried + i)), leave_a);
+        __m256d b = _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(x + carried + i + 4)), leave_b);
+        // Prefix sums within each group of 4: add the vector shifted up one
+        // lane, then shifted up two
+        a = _mm256_add_pd(a, _mm256_blend_pd(_mm256_permute4x64_pd(a, _MM_SHUFFLE(2, 1, 0, 0)), zero, 1));
+        b = _mm256_add_pd(b, _mm256_blend_pd(_mm256_permute4x64_pd(b, _MM_SHUFFLE(2, 1, 0, 0)), zero, 1));
+        a = _mm256_add_pd(a, _mm256_permute2f128_pd(a, a, 0x08));
+        b = _mm256_add_pd(b, _mm256_permute2f128_pd(b, b, 0x08));
+        b = _mm256_add_pd(b, _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 3, 3, 3)));
+        __m128 lo = _mm256_cvtpd_ps(_mm256_add_pd(_mm256_add_pd(a, carry), leave_a));
+        __m128 hi = _mm256_cvtpd_ps(_mm256_add_pd(_mm256_add_pd(b, carry), leave_b));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_set_m128(hi, lo), _mm256_set1_ps(norm)));
+        carry = _mm256_add_pd(carry, _mm256_permute4x64_pd(b, _MM_SHUFFLE(3, 3, 3, 3)));
+    }
+    *sum = _mm256_cvtsd_f64(carry);
+    boxcar_sums_scalar(x + i, carried, n - i, sum, norm, out + i);
+}
+
+#endif // SIMD_KERNELS_X86
+
+class SlidingWindow {
+public:
+    enum class Kernel { boxcar, exponential };
+
+    SlidingWindow() = default;
+
+    void configure(Kernel kernel, int half_window, int channels) {
+        kernel_ = kernel;
+        half_ = std::max(0, half_window);
+        channels_ = channels;
+        int width = 2 * half_ + 1;
+        if (kernel_ == Kernel::boxcar) {
+            norm_ = 1.0f / width;
+            edge_ = 0.0f;
+        } else {
+            decay_ = half_ > 0 ? std::exp(-1.0f / half_) : 0.0f;
+            edge_ = std::pow(decay_, (float)(half_ + 1));
+            float weights = 0.0f;
+            for (int j = -half_; j <= half_; j++) {
+                weights += std::pow(decay_, (float)std::abs(j));
+            }
+            norm_ = 1.0f / weights;
+        }
+        channels_state_.assign(channels, Channel());
+        for (Channel &state : channels_state_) {
+            state.carry.assign(2 * half_, 0.0f);
+        }
+        boxcar_sums_ = boxcar_sums_scalar;
+#ifdef SIMD_KERNELS_X86
+        SimdLevel best = simd_best_level();
+        if (best >= SimdLevel::avx2) {
+            boxcar_sums_ = boxcar_sums_avx2;
+        } else if (best >= SimdLevel::sse2) {
+            boxcar_sums_ = boxcar_sums_sse2;
+        }
+#endif
+        configured_ = true;
+    }
+
+    bool configured_for(Kernel kernel, int half_window, int channels) const {
+        return configured_ && kernel_ == kernel && half_ == half_window && channels_ == channels;
+    }
+
+    // Samples each output trails its input by
+    int latency() const { return half_; }
+    int channels() const { return channels_; }
+
+    // Replaces each sample of channel ch with finish(mean), mean being the
+    // window average centred latency() samples earlier. Goes through a
+    // SampleAccess (see SampleFormat.h).
+    template <typename Access, typename Finish>
+    void process_channel(Access samples, int ch, int nb_samples, Finish finish) {
+        Channel &state = channels_state_[ch];
+        const int carried = 2 * half_;
+        const size_t length = carried + nb_samples;
+        state.work.resize(length);
+        float *x = state.work.data();
+        std::copy(state.carry.begin(), state.carry.end(), x);
+        auto *data = samples.channel(ch);
+        const ptrdiff_t step = samples.step();
+        for (int i = 0; i < nb_samples; i++) {
+            x[carried + i] = Access::read(data[i * step]);
+        }
+
+        if (kernel_ == Kernel::boxcar) {
+            state.forward.resize(nb_samples);
+            float *mean = state.forward.data();
+            boxcar_sums_(x, carried, nb_samples, &state.sum, norm_, mean);
+            for (int i = 0; i < nb_samples; i++) {
+                data[i * step] = Access::write(finish(mean[i]));
+            }
+        } else {
+            // E from the front, S from the back, each padded with one zero
+            // (E[-1], S[length])
+            state.forward.resize(length + 1);
+            state.backward.resize(length + 1);
+            float *e = state.forward.data() + 1, *s = state.backward.data();
+            e[-1] = 0.0f;
+            for (size_t k = 0; k < length; k++) {
+                e[k] = x[k] + decay_ * e[k - 1];
+            }
+            s[length] = 0.0f;
+            for (size_t k = length; k-- > 0;) {
+                s[k] = x[k] + decay_ * s[k + 1];
+            }
+            for (int i = 0; i < nb_samples; i++) {
+                int c = half_ + i;
+                float sum = e[c] - edge_ * e[c - half_ - 1] + s[c] - edge_ * s[c + half_ + 1] - x[c];
+                data[i * step] = Access::write(finish(sum * norm_));
+            }
+        }
+
+        std::copy(x + nb_samples, x + length, state.carry.begin());
+    }
+
+    template <typename Access, typename Finish>
+    void process(Access samples, int nb_samples, Finish finish) {
+        for (int ch = 0; ch < channels_; ch++) {
+            process_channel(samples, ch, nb_samples, finish);
+        }
+    }
+
+    // End of stream: writes the last latency() outputs of every channel,
+    // still held back, with the window running on into silence. samples must
+    // have room for latency() samples per channel.
+    template <typename Access, typename Finish>
+    void flush(Access samples, Finish finish) {
+        for (int ch = 0; ch < channels_; ch++) {
+            auto *data = samples.channel(ch);
+            for (int i = 0; i < half_; i++) {
+                data[i * samples.step()] = Access::write(0.0f);
+            }
+            process_channel(samples, ch, half_, finish);
+        }
+    }
+
+private:
+    struct Channel {
+        std::vector<float> carry;             // Last 2 * half_ input samples
+        double sum = 0.0;                     // Boxcar: sum of carry
+        std::vector<float> work;              // carry followed by the frame
+        std::vector<float> forward, backward; // Exponential: E and S over work; boxcar: means in forward
+    };
+
+    Kernel kernel_ = Kernel::boxcar;
+    int half_ = 0;
+    int channels_ = 0;
+    float norm_ = 1.0f;  // 1 / sum of the window's weights
+    float decay_ = 0.0f; // r
+    float edge_ = 0.0f;  // r^(half_ + 1)
+    bool configured_ = false;
+    void (*boxcar_sums_)(const float *, int, int, double *, float, float *) = boxcar_sums_scalar;
+    std::vector<Channel> channels_state_;
+};
+
+#endif
@@ -0,0 +1,268 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Bounded single-producer/single-consumer ring buffer.
+//
+// The producer only writes tail_ and the consumer only writes head_; each side
+// publishes its index with a release store and reads the other's with an
+// acquire load, so a push or pop on the fast path is a handful of loads and
+// one store with no lock. Each side also keeps a private copy of the other's
+// index and refreshes it only when the ring looks full (or empty).
+//
+// Besides the slot count the ring can be bounded in bytes: every push states
+// what its item weighs and the producer is held back (backpressure) while
+// the items in flight would exceed max_bytes. An item is always admitted into
+// an empty ring, so an oversized one cannot wedge the pipeline.
+//
+// For instrumentation the ring records the most items and bytes it ever held,
+// a histogram of its depth after each push (power-of-two buckets), and how
+// long each side spent blocked. Only the blocking path reads the clock.
+//
+// When a side has to wait it spins for a while, then parks on a condition
+// variable. It announces that with a waiting flag followed by a seq_cst fence;
+// the other side fences after publishing its index and only takes the mutex
+// when it sees the flag, so the lock and notify are paid only when somebody
+// is actually asleep.
+template <typename T>
+class SpscRing {
+public:
+    // Capacity is rounded up to a power of two. max_bytes == 0 means only the
+    // slot count bounds the ring.
+    explicit SpscRing(size_t min_capacity, size_t max_bytes = 0) : max_bytes_(max_bytes) {
+        size_t capacity = 2;
+        while (capacity < min_capacity) {
+            capacity <<= 1;
+        }
+        slots_.resize(capacity);
+        slot_bytes_.resize(capacity);
+        mask_ = capacity - 1;
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    size_t capacity() const { return mask_ + 1; }
+    size_t max_bytes() const { return max_bytes_; }
+
+    // Producer side. Blocks while the ring is full (in slots or bytes);
+    // returns false (and leaves value alone) if the ring was closed.
+    bool push(T value, size_t bytes = 0) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (!has_room(tail, bytes)) {
+            auto room_or_closed = [&] {
+                refresh_consumer_progress();
+                return has_room(tail, bytes) || closed_.load(std::memory_order_acquire);
+            };
+            wait_until(producer_waiting_, not_full_, room_or_closed, producer_wait_ns_);
+            if (!has_room(tail, bytes)) {
+                return false;
+            }
+        }
+        publish(tail, value, bytes);
+        return true;
+    }
+
+    // Consumer side. Blocks while the ring is empty; returns false once the
+    // ring is closed and drained.
+    bool pop(T &value) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == consumer_tail_) {
+            auto has_item = [&] {
+                consumer_tail_ = tail_.load(std::memory_order_acquire);
+                return head != consumer_tail_ || closed_.load(std::memory_order_acquire);
+            };
+            wait_until(consumer_waiting_, not_empty_, has_item, consumer_wait_ns_);
+            if (head == consumer_tail_) {
+                // Closed: anything pushed before close() is visible now
+                consumer_tail_ = tail_.load(std::memory_order_acquire);
+                if (head == consumer_tail_) {
+                    return false;
+                }
+            }
+        }
+        consume(head, value);
+        return true;
+    }
+
+    // Non-blocking versions: false (value untouched) if the ring is full or
+    // empty right now
+    bool try_push(T &value, size_t bytes = 0) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (!has_room(tail, bytes)) {
+            refresh_consumer_progress();
+            if (!has_room(tail, bytes)) {
+                return false;
+            }
+        }
+        publish(tail, value, bytes);
+        return true;
+    }
+
+    bool try_pop(T &value) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == consumer_tail_) {
+            consumer_tail_ = tail_.load(std::memory_order_acquire);
+            if (head == consumer_tail_) {
+                return false;
+            }
+        }
+        consume(head, value);
+        return true;
+    }
+
+    // No more pushes. The consumer still drains what is queued; a producer
+    // blocked on a full ring gives up.
+    void close() {
+        closed_.store(true, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(park_mtx_);
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    // Most items / bytes held at once so far
+    size_t high_water() const { return high_water_.load(std::memory_order_relaxed); }
+    size_t high_water_bytes() const { return high_water_bytes_.load(std::memory_order_relaxed); }
+
+    // Pushes that left the ring holding [2^bucket, 2^(bucket+1)) items; the
+    // last bucket takes everything above
+    static constexpr int kDepthBuckets = 16;
+    uint64_t depth_count(int bucket) const { return depth_histogram_[bucket].load(std::memory_order_relaxed); }
+
+    // Time spent blocked in push() on a full ring / in pop() on an empty one
+    uint64_t producer_wait_ns() const { return producer_wait_ns_.load(std::memory_order_relaxed); }
+    uint64_t consumer_wait_ns() const { return consumer_wait_ns_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t kCacheLine = 64;
+    static constexpr int kSpinIterations = 256;
+
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+    // Producer side, against its cached view of the consumer
+    bool has_room(size_t tail, size_t bytes) const {
+        if (tail - producer_head_ > mask_) {
+            return false;
+        }
+        return max_bytes_ == 0 || tail == producer_head_ || bytes_pushed_ - producer_popped_ + bytes <= max_bytes_;
+    }
+
+    void refresh_consumer_progress() {
+        producer_head_ = head_.load(std::memory_order_acquire);
+        producer_popped_ = bytes_popped_.load(std::memory_order_acquire);
+    }
+
+    void publish(size_t tail, T &value, size_t bytes) {
+        slots_[tail & mask_] = std::move(value);
+        slot_bytes_[tail & mask_] = bytes;
+        bytes_pushed_ += bytes;
+        tail_.store(tail + 1, std::memory_order_release);
+        wake(consumer_waiting_, not_empty_);
+
+        // Occupancy right after this push; the consumer may already have
+        // taken some, which only makes this an upper bound for an instant
+        size_t depth = tail + 1 - head_.load(std::memory_order_relaxed);
+        size_t in_flight = bytes_pushed_ - bytes_popped_.load(std::memory_order_relaxed);
+        if (depth > high_water_.load(std::memory_order_relaxed)) {
+            high_water_.store(depth, std::memory_order_relaxed);
+        }
+        if (in_flight > high_water_bytes_.load(std::memory_order_relaxed)) {
+            high_water_bytes_.store(in_flight, std::memory_order_relaxed);
+        }
+        std::atomic<uint64_t> &bucket = depth_histogram_[depth_bucket(depth)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static int depth_bucket(size_t depth) {
+        int bucket = 0;
+        while (depth > 1 && bucket < kDepthBuckets - 1) {
+            depth >>= 1;
+            bucket++;
+        }
+        return bucket;
+    }
+
+    void consume(size_t head, T &value) {
+        value = std::move(slots_[head & mask_]);
+        bytes_popped_.store(bytes_popped_.load(std::memory_order_relaxed) + slot_bytes_[head & mask_],
+                            std::memory_order_release);
+        head_.store(head + 1, std::memory_order_release);
+        wake(producer_waiting_, not_full_);
+    }
+
+    template <typename Ready>
+    void wait_until(std::atomic<bool> &waiting, std::condition_variable &cv, Ready ready,
+                    std::atomic<uint64_t> &wait_ns) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < kSpinIterations && !ready(); i++) {
+            cpu_relax();
+        }
+        if (!ready()) {
+            std::unique_lock<std::mutex> lock(park_mtx_);
+            waiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (!ready()) {
+                cv.wait(lock);
+            }
+            waiting.store(false, std::memory_order_relaxed);
+        }
+        uint64_t waited = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        wait_ns.store(wait_ns.load(std::memory_order_relaxed) + waited, std::memory_order_relaxed);
+    }
+
+    void wake(std::atomic<bool> &waiting, std::condition_variable &cv) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(park_mtx_);
+            cv.notify_one();
+        }
+    }
+
+    // Consumer-owned line
+    alignas(kCacheLine) std::atomic<size_t> head_{0};
+    std::atomic<size_t> bytes_popped_{0};
+    size_t consumer_tail_ = 0;
+    std::atomic<uint64_t> consumer_wait_ns_{0};
+
+    // Producer-owned line
+    alignas(kCacheLine) std::atomic<size_t> tail_{0};
+    size_t producer_head_ = 0;
+    size_t producer_popped_ = 0;
+    size_t bytes_pushed_ = 0;
+    std::atomic<size_t> high_water_{0};
+    std::atomic<size_t> high_water_bytes_{0};
+    std::atomic<uint64_t> producer_wait_ns_{0};
+    std::atomic<uint64_t> depth_histogram_[kDepthBuckets] = {};
+
+    // Shared, read-mostly: written only when a side parks or on close()
+    alignas(kCacheLine) std::vector<T> slots_;
+    std::vector<size_t> slot_bytes_;
+    size_t mask_ = 0;
+    size_t max_bytes_;
+    std::atomic<bool> closed_{false};
+    std::atomic<bool> consumer_waiting_{false};
+    std::atomic<bool> producer_waiting_{false};
+
+    // Slow path only
+    alignas(kCacheLine) std::mutex park_mtx_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef STAGE_STATS_H
+#define STAGE_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Counters for one pipeline stage (or one effect within a stage), shared by
+// every thread that runs it. Updates are relaxed atomic adds, so a stage can
+// count per item; time is taken per batch or per thread, not per sample.
+//
+// active_ns is the time the stage's threads were running at all. How much of
+// that went to waiting on queues is recorded by the queues themselves (see
+// SpscRing), so the report derives busy time as active minus waits.
+struct StageStats {
+    const char *name;
+    std::atomic<uint64_t> active_ns{0};
+    std::atomic<uint64_t> items{0};
+    std::atomic<uint64_t> samples{0};
+    std::atomic<int> threads{0};
+
+    explicit StageStats(const char *stage_name) : name(stage_name) {}
+
+    void count(uint64_t nb_items, uint64_t nb_samples = 0) {
+        items.fetch_add(nb_items, std::memory_order_relaxed);
+        samples.fetch_add(nb_samples, std::memory_order_relaxed);
+    }
+
+    void add_time(uint64_t ns) { active_ns.fetch_add(ns, std::memory_order_relaxed); }
+};
+
+inline uint64_t stage_clock_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Adds the lifetime of the scope to stats.active_ns; one per stage thread
+class StageTimer {
+public:
+    explicit StageTimer(StageStats &stats) : stats_(stats), start_(stage_clock_ns()) {
+        stats_.threads.fetch_add(1, std::memory_order_relaxed);
+    }
+    ~StageTimer() { stats_.add_time(stage_clock_ns() - start_); }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    StageStats &stats_;
+    uint64_t start_;
+};
+
+#endif
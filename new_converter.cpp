@@ -2,30 +2,50 @@
 #include <vector>
 #include <utility>
 #include <string>
+#include <functional>
+extern "C" {
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libavutil/avutil.h>
+#include <libavutil/audio_fifo.h>
+}
 
 using namespace std;
 
-vector<pair<AVFrame*, int64_t>> decode(const string& input_filename) {
-    vector<pair<AVFrame*, int64_t>> frames;
+// Frames flow decode -> process -> encode one at a time and are released as
+// soon as the encoder has them, so memory does not grow with the input length.
+
+void process(AVFrame* frame, const AVCodecContext* codec_ctx) {
+    // Planar float, which is what the MP3 decoder produces
+    if (frame->format != AV_SAMPLE_FMT_FLTP) {
+        return;
+    }
+    for (int i = 0; i < frame->nb_samples; i++) {
+        for (int ch = 0; ch < codec_ctx->ch_layout.nb_channels; ch++) {
+            ((float*)frame->data[ch])[i] *= 0.5; // Decrease volume by half
+        }
+    }
+}
+
+// Calls on_frame for every decoded frame. The frame is only borrowed and is
+// reused for the next one once on_frame returns.
+bool decode(const string& input_filename, const function<bool(AVFrame*, const AVCodecContext*)>& on_frame) {
     AVFormatContext* format_ctx = nullptr;
-    const AVCodecContext* codec_ctx = nullptr;
+    AVCodecContext* codec_ctx = nullptr;
     const AVCodec* codec = nullptr;
-    AVPacket* packet = av_packet_alloc();
-    AVFrame* frame = av_frame_alloc();
+    int stream_index = -1;
 
     // Open input file
     if (avformat_open_input(&format_ctx, input_filename.c_str(), nullptr, nullptr) < 0) {
         cerr << "Error opening input file." << endl;
-        return frames;
+        return false;
     }
 
     // Find the audio stream
     if (avformat_find_stream_info(format_ctx, nullptr) < 0) {
         cerr << "Error finding stream info." << endl;
-        return frames;
+        avformat_close_input(&format_ctx);
+        return false;
     }
 
     for (unsigned int i = 0; i < format_ctx->nb_streams; i++) {
@@ -33,112 +53,211 @@ vector<pair<AVFrame*, int64_t>> decode(const string& input_filename) {
         if (codec && format_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
             codec_ctx = avcodec_alloc_context3(codec);
             avcodec_parameters_to_context(codec_ctx, format_ctx->streams[i]->codecpar);
-            avcodec_open2(codec_ctx, codec, nullptr);
+            codec_ctx->pkt_timebase = format_ctx->streams[i]->time_base;
+            if (avcodec_open2(codec_ctx, codec, nullptr) < 0) {
+                avcodec_free_context(&codec_ctx);
+            }
+            stream_index = i;
             break;
         }
     }
+    if (!codec_ctx) {
+        cerr << "Error opening audio decoder." << endl;
+        avformat_close_input(&format_ctx);
+        return false;
+    }
 
-    // Read frames from the input file
-    while (av_read_frame(format_ctx, packet) >= 0) {
-        if (packet->stream_index == i) {
-            avcodec_send_packet(codec_ctx, packet);
-            while (avcodec_receive_frame(codec_ctx, frame) >= 0) {
-                frames.emplace_back(make_pair(av_frame_clone(frame), frame->pts));
-            }
+    AVPacket* packet = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    bool ok = true;
+
+    // Read frames from the input file, sending a null packet at the end to drain the decoder
+    bool draining = false;
+    while (ok && !draining) {
+        if (av_read_frame(format_ctx, packet) < 0) {
+            draining = true;
+        } else if (packet->stream_index != stream_index) {
+            av_packet_unref(packet);
+            continue;
+        }
+        avcodec_send_packet(codec_ctx, draining ? nullptr : packet);
+        while (ok && avcodec_receive_frame(codec_ctx, frame) >= 0) {
+            ok = on_frame(frame, codec_ctx);
+            av_frame_unref(frame);
         }
         av_packet_unref(packet);
     }
 
-    process(frames, codec_ctx);
     // Clean up
     av_frame_free(&frame);
     av_packet_free(&packet);
     avcodec_free_context(&codec_ctx);
     avformat_close_input(&format_ctx);
 
-    return frames;
+    return ok;
 }
 
-void process(vector<pair<AVFrame*, int64_t>>& frames, const AVCodecContext* codec_ctx) {
-    for (auto& frame_pair : frames) {
-        AVFrame* frame = frame_pair.first;
-        for (int i = 0; i < frame->nb_samples; i++) {
-            for (int ch = 0; ch < codec_ctx->ch_layout.nb_channels; ch++) {
-                ((float*)frame->data[ch])[i] *= 0.5; // Decrease volume by half
-            }
-        }
+// Output side: encoder plus muxer. Decoded frames rarely match the encoder's
+// frame size, so samples are re-cut through a small FIFO.
+struct Encoder {
+    AVFormatContext* format_ctx = nullptr;
+    AVCodecContext* codec_ctx = nullptr;
+    AVStream* stream = nullptr;
+    AVAudioFifo* fifo = nullptr;
+    AVFrame* frame = nullptr;
+    AVPacket* packet = nullptr;
+    int64_t next_pts = 0;
+};
+
+void close_encoder(Encoder& encoder) {
+    if (encoder.format_ctx && encoder.format_ctx->pb) {
+        avio_closep(&encoder.format_ctx->pb);
+    }
+    avformat_free_context(encoder.format_ctx);
+    encoder.format_ctx = nullptr;
+    avcodec_free_context(&encoder.codec_ctx);
+    if (encoder.fifo) {
+        av_audio_fifo_free(encoder.fifo);
+        encoder.fifo = nullptr;
     }
+    av_frame_free(&encoder.frame);
+    av_packet_free(&encoder.packet);
 }
 
-void encode(const string& output_filename, const vector<pair<AVFrame*, int64_t>>& frames, AVCodecID codec_id) {
-    AVFormatContext* format_ctx = nullptr;
-    AVCodecContext* codec_ctx = nullptr;
+bool open_encoder(Encoder& encoder, const string& output_filename, AVCodecID codec_id, const AVCodecContext* dec_ctx) {
     const AVCodec* codec = avcodec_find_encoder(codec_id);
-    
+
     if (!codec) {
         cerr << "Codec not found." << endl;
-        return;
+        return false;
     }
 
-    avformat_alloc_output_context2(&format_ctx, nullptr, nullptr, output_filename.c_str());
-    
-    AVStream* stream = avformat_new_stream(format_ctx, codec);
-    codec_ctx = avcodec_alloc_context3(codec);
+    avformat_alloc_output_context2(&encoder.format_ctx, nullptr, nullptr, output_filename.c_str());
+    if (!encoder.format_ctx) {
+        cerr << "Could not create output context." << endl;
+        return false;
+    }
 
-    codec_ctx->bit_rate = 64000; // Set bitrate
-    codec_ctx->sample_rate = 44100; // Set sample rate
-    codec_ctx->ch_layout = AV_CHANNEL_LAYOUT_STEREO; // Set channel layout
-    codec_ctx->codec_type = AVMEDIA_TYPE_AUDIO;
+    encoder.stream = avformat_new_stream(encoder.format_ctx, codec);
+    encoder.codec_ctx = avcodec_alloc_context3(codec);
+
+    encoder.codec_ctx->bit_rate = 64000; // Set bitrate
+    encoder.codec_ctx->sample_rate = dec_ctx->sample_rate; // Keep the input's sample rate
+    av_channel_layout_copy(&encoder.codec_ctx->ch_layout, &dec_ctx->ch_layout); // And its channel layout
+    encoder.codec_ctx->sample_fmt = dec_ctx->sample_fmt;
+    encoder.codec_ctx->time_base = {1, dec_ctx->sample_rate};
+    encoder.codec_ctx->codec_type = AVMEDIA_TYPE_AUDIO;
+
+    if (avcodec_open2(encoder.codec_ctx, codec, nullptr) < 0) {
+        cerr << "Could not open encoder." << endl;
+        close_encoder(encoder);
+        return false;
+    }
 
     // Set codec parameters
-    avcodec_parameters_from_context(stream->codecpar, codec_ctx);
+    avcodec_parameters_from_context(encoder.stream->codecpar, encoder.codec_ctx);
+    encoder.stream->time_base = encoder.codec_ctx->time_base;
 
     // Open the output file
-    if (avio_open(&format_ctx->pb, output_filename.c_str(), AVIO_FLAG_WRITE) < 0) {
+    if (avio_open(&encoder.format_ctx->pb, output_filename.c_str(), AVIO_FLAG_WRITE) < 0) {
         cerr << "Could not open output file." << endl;
-        return;
+        close_encoder(encoder);
+        return false;
     }
 
     // Write header and check for errors
-    int ret = avformat_write_header(format_ctx, nullptr);
+    int ret = avformat_write_header(encoder.format_ctx, nullptr);
     if (ret < 0) {
-        cerr << "Error writing header: " << av_err2str(ret) << endl;
-        return;
+        cerr << "Error writing header: " << ret << endl;
+        close_encoder(encoder);
+        return false;
     }
 
-    for (const auto& frame_pair : frames) {
-        AVFrame* frame = frame_pair.first;
+    int frame_size = encoder.codec_ctx->frame_size > 0 ? encoder.codec_ctx->frame_size : 1152;
+    encoder.fifo = av_audio_fifo_alloc(encoder.codec_ctx->sample_fmt, encoder.codec_ctx->ch_layout.nb_channels, frame_size);
+    encoder.frame = av_frame_alloc();
+    encoder.packet = av_packet_alloc();
+    if (!encoder.fifo || !encoder.frame || !encoder.packet) {
+        cerr << "Could not allocate encoder buffers." << endl;
+        close_encoder(encoder);
+        return false;
+    }
+    encoder.frame->nb_samples = frame_size;
+    encoder.frame->format = encoder.codec_ctx->sample_fmt;
+    encoder.frame->sample_rate = encoder.codec_ctx->sample_rate;
+    av_channel_layout_copy(&encoder.frame->ch_layout, &encoder.codec_ctx->ch_layout);
+    if (av_frame_get_buffer(encoder.frame, 0) < 0) {
+        cerr << "Could not allocate encoder frame." << endl;
+        close_encoder(encoder);
+        return false;
+    }
+    return true;
+}
 
-        // Send the frame to the encoder
-        avcodec_send_frame(codec_ctx, frame);
-        AVPacket* packet = av_packet_alloc();
-        
-        while (avcodec_receive_packet(codec_ctx, packet) >= 0) {
-            av_interleaved_write_frame(format_ctx, packet);
-            av_packet_unref(packet);
-        }
-        av_frame_free(&frame);
+// Send one frame (nullptr flushes) and write every packet that is ready
+bool encode_and_write(Encoder& encoder, AVFrame* frame) {
+    if (avcodec_send_frame(encoder.codec_ctx, frame) < 0) {
+        cerr << "Error sending frame to encoder." << endl;
+        return false;
+    }
+    while (avcodec_receive_packet(encoder.codec_ctx, encoder.packet) >= 0) {
+        encoder.packet->stream_index = encoder.stream->index;
+        av_packet_rescale_ts(encoder.packet, encoder.codec_ctx->time_base, encoder.stream->time_base);
+        av_interleaved_write_frame(encoder.format_ctx, encoder.packet);
+        av_packet_unref(encoder.packet);
     }
+    return true;
+}
 
-    av_write_trailer(format_ctx);
-    avio_close(format_ctx->pb);
-    avcodec_free_context(&codec_ctx);
-    avformat_free_context(format_ctx);
+// Queue a frame and encode every full encoder frame; a null frame encodes the
+// remainder and flushes the encoder
+bool encode(Encoder& encoder, const AVFrame* frame) {
+    if (frame && av_audio_fifo_write(encoder.fifo, (void**)frame->extended_data, frame->nb_samples) < frame->nb_samples) {
+        cerr << "Could not queue samples for encoding." << endl;
+        return false;
+    }
+
+    int frame_size = encoder.frame->nb_samples;
+    while (av_audio_fifo_size(encoder.fifo) >= frame_size || (!frame && av_audio_fifo_size(encoder.fifo) > 0)) {
+        if (av_frame_make_writable(encoder.frame) < 0) {
+            return false;
+        }
+        int samples = av_audio_fifo_read(encoder.fifo, (void**)encoder.frame->extended_data, frame_size);
+        encoder.frame->nb_samples = samples;
+        encoder.frame->pts = encoder.next_pts;
+        encoder.next_pts += samples;
+        bool sent = encode_and_write(encoder, encoder.frame);
+        encoder.frame->nb_samples = frame_size;
+        if (!sent) {
+            return false;
+        }
+    }
+    return frame || encode_and_write(encoder, nullptr);
 }
 
 int main() {
     const string input_file = "input.mp3"; // Replace with your input file
     const string output_file = "output.mp3"; // Replace with your output file
 
-    // Decode
-    auto frames = decode(input_file);
+    // Decode, process and encode each frame as it comes out of the decoder
+    Encoder encoder;
+    bool ok = decode(input_file, [&](AVFrame* frame, const AVCodecContext* codec_ctx) {
+        if (!encoder.codec_ctx && !open_encoder(encoder, output_file, AV_CODEC_ID_MP3, codec_ctx)) { // Use appropriate codec ID
+            return false;
+        }
+
+        // Process
+        process(frame, codec_ctx);
 
-    // Process
-    //process(frames);
+        // Encode
+        return encode(encoder, frame);
+    });
 
-    // Encode
-    encode(output_file, frames, AV_CODEC_ID_MP3); // Use appropriate codec ID
+    if (ok && encoder.codec_ctx) {
+        ok = encode(encoder, nullptr);
+        av_write_trailer(encoder.format_ctx);
+    }
+    close_encoder(encoder);
 
-    return 0;
+    return ok ? 0 : 1;
 }
-